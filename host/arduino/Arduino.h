@@ -0,0 +1,87 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Minimal Arduino core for host (Linux) builds of the firmware modules.
+// Time, GPIO and ADC are routed through host_hal.h so tools can drive them.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdarg.h>
+#include "WString.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define F(s) (s)
+#define PROGMEM
+#define IRAM_ATTR
+
+// 32-bit like the ESP counters, so timing code sees the same wrap-around
+uint32_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax)
+{
+    if (inMax == inMin)
+        return outMin;
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+template <typename T, typename L, typename H>
+inline T constrain(T x, L low, H high)
+{
+    return x < (T)low ? (T)low : (x > (T)high ? (T)high : x);
+}
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long) {}
+    void setDebugOutput(bool) {}
+
+    size_t write(const char *s, size_t n);
+    size_t print(const char *s) { return write(s, strlen(s)); }
+    size_t print(const String &s) { return write(s.c_str(), s.length()); }
+    size_t print(char c) { return write(&c, 1); }
+    size_t print(int v) { return print(String(v)); }
+    size_t print(unsigned int v) { return print(String(v)); }
+    size_t print(long v) { return print(String(v)); }
+    size_t print(unsigned long v) { return print(String(v)); }
+    size_t print(double v, int digits = 2) { return print(String(v, (unsigned char)digits)); }
+
+    template <typename T>
+    size_t println(const T &v) { return print(v) + println(); }
+    size_t println() { return print("\n"); }
+
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+    void restart();
+    uint32_t getFreeHeap();
+};
+
+extern EspClass ESP;
+
+#endif
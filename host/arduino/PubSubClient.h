@@ -0,0 +1,136 @@
+#ifndef HOST_PUBSUBCLIENT_H
+#define HOST_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <functional>
+
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 256
+#endif
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+#define MQTT_CONNECT_BAD_PROTOCOL 1
+#define MQTT_CONNECT_BAD_CLIENT_ID 2
+#define MQTT_CONNECT_UNAVAILABLE 3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED 5
+
+typedef std::function<void(char *, uint8_t *, unsigned int)> MqttCallback;
+
+struct MqttConnectOptions
+{
+    const char *host;
+    uint16_t port;
+    const char *clientId;
+    const char *user;
+    const char *pass;
+    const char *willTopic;
+    uint8_t willQos;
+    bool willRetain;
+    const char *willMessage;
+    uint16_t keepAlive;
+};
+
+// Backend of the host PubSubClient: a capture sink for the simulator,
+// a real socket for the load generator.
+class HostMqttTransport
+{
+public:
+    virtual ~HostMqttTransport() {}
+    virtual bool connect(const MqttConnectOptions &options) = 0;
+    virtual void disconnect() = 0;
+    virtual bool connected() = 0;
+    virtual int state() = 0;
+    virtual bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained) = 0;
+    virtual bool subscribe(const char *topic, uint8_t qos) = 0;
+    // Dispatches pending inbound messages through the callback
+    virtual bool loop(const MqttCallback &callback) = 0;
+};
+
+// API-compatible subset of knolleary/PubSubClient used by src/mqtt.cpp
+class PubSubClient
+{
+public:
+    explicit PubSubClient(Client &) {}
+
+    void attach(HostMqttTransport *transport) { _transport = transport; }
+    HostMqttTransport *transport() const { return _transport; }
+
+    PubSubClient &setServer(const char *host, uint16_t port)
+    {
+        _host = host;
+        _port = port;
+        return *this;
+    }
+    PubSubClient &setCallback(MqttCallback callback)
+    {
+        _callback = callback;
+        return *this;
+    }
+    PubSubClient &setKeepAlive(uint16_t seconds)
+    {
+        _keepAlive = seconds;
+        return *this;
+    }
+    bool setBufferSize(uint16_t size)
+    {
+        _bufferSize = size;
+        return true;
+    }
+    uint16_t getBufferSize() const { return _bufferSize; }
+
+    bool connect(const char *id, const char *user, const char *pass,
+                 const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage)
+    {
+        if (!_transport)
+            return false;
+        MqttConnectOptions options = {_host, _port, id, user, pass, willTopic, willQos, willRetain, willMessage, _keepAlive};
+        return _transport->connect(options);
+    }
+    bool connect(const char *id, const char *user = nullptr, const char *pass = nullptr)
+    {
+        return connect(id, user, pass, nullptr, 0, false, nullptr);
+    }
+    void disconnect()
+    {
+        if (_transport)
+            _transport->disconnect();
+    }
+    bool connected() { return _transport && _transport->connected(); }
+    int state() { return _transport ? _transport->state() : MQTT_DISCONNECTED; }
+
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained = false)
+    {
+        // Same limit as the real client: fixed header + topic + payload must fit the buffer
+        if (!connected() || 5 + 2 + strlen(topic) + length > _bufferSize)
+            return false;
+        return _transport->publish(topic, payload, length, retained);
+    }
+    bool publish(const char *topic, const char *payload, bool retained = false)
+    {
+        return publish(topic, (const uint8_t *)payload, strlen(payload), retained);
+    }
+    bool subscribe(const char *topic, uint8_t qos = 0)
+    {
+        return connected() && _transport->subscribe(topic, qos);
+    }
+    bool loop()
+    {
+        return connected() && _transport->loop(_callback);
+    }
+
+private:
+    HostMqttTransport *_transport = nullptr;
+    MqttCallback _callback;
+    const char *_host = nullptr;
+    uint16_t _port = 1883;
+    uint16_t _keepAlive = 15;
+    uint16_t _bufferSize = MQTT_MAX_PACKET_SIZE;
+};
+
+#endif
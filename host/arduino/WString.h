@@ -0,0 +1,131 @@
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#define DEC 10
+#define HEX 16
+
+// Host stand-in for the Arduino String class, backed by std::string.
+// Only the subset used by the firmware and by ArduinoJson is provided.
+class String
+{
+public:
+    String() {}
+    String(const char *s) : _s(s ? s : "") {}
+    String(const std::string &s) : _s(s) {}
+    explicit String(char c) : _s(1, c) {}
+    String(int v, unsigned char base = DEC) { fromLong(v, base); }
+    String(unsigned int v, unsigned char base = DEC) { fromUnsigned(v, base); }
+    String(long v, unsigned char base = DEC) { fromLong(v, base); }
+    String(unsigned long v, unsigned char base = DEC) { fromUnsigned(v, base); }
+    String(float v, unsigned char decimals = 2) { fromDouble(v, decimals); }
+    String(double v, unsigned char decimals = 2) { fromDouble(v, decimals); }
+
+    const char *c_str() const { return _s.c_str(); }
+    unsigned int length() const { return (unsigned int)_s.size(); }
+    bool isEmpty() const { return _s.empty(); }
+    void reserve(unsigned int size) { _s.reserve(size); }
+    char charAt(unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+
+    bool concat(const char *s) { if (s) _s += s; return true; }
+    bool concat(const char *s, unsigned int n) { if (s) _s.append(s, n); return true; }
+    bool concat(const String &s) { _s += s._s; return true; }
+    bool concat(char c) { _s += c; return true; }
+    bool concat(int v) { return concat(String(v)); }
+    bool concat(unsigned int v) { return concat(String(v)); }
+    bool concat(long v) { return concat(String(v)); }
+    bool concat(unsigned long v) { return concat(String(v)); }
+
+    template <typename T>
+    String &operator+=(const T &v) { concat(v); return *this; }
+
+    void toUpperCase() { for (auto &c : _s) c = (char)toupper((unsigned char)c); }
+    void toLowerCase() { for (auto &c : _s) c = (char)tolower((unsigned char)c); }
+    void trim()
+    {
+        size_t b = _s.find_first_not_of(" \t\r\n");
+        size_t e = _s.find_last_not_of(" \t\r\n");
+        _s = b == std::string::npos ? std::string() : _s.substr(b, e - b + 1);
+    }
+
+    int indexOf(char c, unsigned int from = 0) const
+    {
+        size_t p = _s.find(c, from);
+        return p == std::string::npos ? -1 : (int)p;
+    }
+    int indexOf(const char *s, unsigned int from = 0) const
+    {
+        size_t p = _s.find(s, from);
+        return p == std::string::npos ? -1 : (int)p;
+    }
+    bool startsWith(const char *s) const { return _s.compare(0, strlen(s), s) == 0; }
+    String substring(unsigned int from) const { return from < _s.size() ? String(_s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if (from >= _s.size() || to <= from)
+            return String();
+        return String(_s.substr(from, to - from));
+    }
+    long toInt() const { return strtol(_s.c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(_s.c_str(), nullptr); }
+
+    bool equals(const String &o) const { return _s == o._s; }
+    bool equals(const char *o) const { return o && _s == o; }
+    bool operator==(const String &o) const { return _s == o._s; }
+    bool operator==(const char *o) const { return equals(o); }
+    bool operator!=(const String &o) const { return _s != o._s; }
+    bool operator!=(const char *o) const { return !equals(o); }
+    bool operator<(const String &o) const { return _s < o._s; }
+
+    const std::string &str() const { return _s; }
+
+private:
+    void fromUnsigned(unsigned long v, unsigned char base)
+    {
+        char buf[8 * sizeof(unsigned long) + 1];
+        char *p = buf + sizeof(buf) - 1;
+        *p = 0;
+        do
+        {
+            unsigned d = (unsigned)(v % base);
+            *--p = (char)(d < 10 ? '0' + d : 'a' + d - 10);
+            v /= base;
+        } while (v);
+        _s = p;
+    }
+    void fromLong(long v, unsigned char base)
+    {
+        if (v < 0 && base == DEC)
+        {
+            fromUnsigned((unsigned long)(-v), base);
+            _s.insert(_s.begin(), '-');
+        }
+        else
+        {
+            fromUnsigned((unsigned long)v, base);
+        }
+    }
+    void fromDouble(double v, unsigned char decimals)
+    {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        _s = buf;
+    }
+
+    std::string _s;
+};
+
+inline String operator+(const String &a, const String &b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, const char *b) { String r(a); r.concat(b); return r; }
+inline String operator+(const char *a, const String &b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, char b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, int b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, unsigned int b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, long b) { String r(a); r.concat(b); return r; }
+inline String operator+(const String &a, unsigned long b) { String r(a); r.concat(b); return r; }
+
+#endif
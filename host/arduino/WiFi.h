@@ -0,0 +1,48 @@
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include <Arduino.h>
+
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+class IPAddress
+{
+public:
+    IPAddress(uint8_t a = 127, uint8_t b = 0, uint8_t c = 0, uint8_t d = 1) : _a(a), _b(b), _c(c), _d(d) {}
+    String toString() const
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _a, _b, _c, _d);
+        return String(buf);
+    }
+
+private:
+    uint8_t _a, _b, _c, _d;
+};
+
+// Placeholder for the network client PubSubClient is constructed with;
+// on the host the transport is chosen through PubSubClient::attach().
+class Client
+{
+public:
+    virtual ~Client() {}
+};
+
+class WiFiClient : public Client
+{
+};
+
+class HostWiFi
+{
+public:
+    int status() const { return WL_CONNECTED; }
+    int RSSI() const { return rssi; }
+    IPAddress localIP() const { return IPAddress(); }
+
+    int rssi = -60;
+};
+
+extern HostWiFi WiFi;
+
+#endif
@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#include <time.h>
+#include <WiFi.h>
+#include "host_hal.h"
+
+HardwareSerial Serial;
+HostWiFi WiFi;
+EspClass ESP;
+
+namespace
+{
+    const int kPinCount = 64;
+
+    bool realTime = false;
+    uint64_t virtualMs = 0;
+    uint64_t realStartMs = 0;
+    uint32_t epochBase = 1700000000UL;
+    uint8_t pinLevels[kPinCount] = {0};
+    uint32_t pinPulses[kPinCount] = {0};
+    bool serialEcho = false;
+
+    std::function<int(uint8_t)> analogSource;
+    std::function<void(uint8_t, uint8_t)> pinWriteHook;
+    std::function<void(unsigned long)> delayHook;
+    std::function<void()> restartHook;
+
+    uint64_t monotonicMs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+    }
+}
+
+namespace host
+{
+    void useRealTime(bool enabled)
+    {
+        realTime = enabled;
+        realStartMs = monotonicMs();
+    }
+
+    uint64_t nowMs()
+    {
+        return realTime ? monotonicMs() - realStartMs : virtualMs;
+    }
+
+    void setTimeMs(uint64_t ms) { virtualMs = ms; }
+    void advanceTime(uint64_t ms) { virtualMs += ms; }
+
+    void setEpochBase(uint32_t epoch) { epochBase = epoch; }
+    uint32_t epochNow() { return epochBase + (uint32_t)(nowMs() / 1000ULL); }
+
+    void setAnalogSource(std::function<int(uint8_t)> source) { analogSource = source; }
+    void setPinWriteHook(std::function<void(uint8_t, uint8_t)> hook) { pinWriteHook = hook; }
+
+    int pinLevel(uint8_t pin) { return pin < kPinCount ? pinLevels[pin] : LOW; }
+
+    void resetPins()
+    {
+        memset(pinLevels, 0, sizeof(pinLevels));
+        memset(pinPulses, 0, sizeof(pinPulses));
+    }
+
+    void addPulses(uint8_t pin, uint32_t count)
+    {
+        if (pin < kPinCount)
+            pinPulses[pin] += count;
+    }
+
+    uint32_t pulseCount(uint8_t pin) { return pin < kPinCount ? pinPulses[pin] : 0; }
+
+    void setDelayHook(std::function<void(unsigned long)> hook) { delayHook = hook; }
+    void setRestartHook(std::function<void()> hook) { restartHook = hook; }
+
+    void setSerialEcho(bool enabled) { serialEcho = enabled; }
+}
+
+// Truncated like the ESP counters: millis() wraps every 49.7 days, micros()
+// every 71.6 minutes. host::nowMs() keeps counting past the wrap.
+uint32_t millis() { return (uint32_t)host::nowMs(); }
+uint32_t micros() { return (uint32_t)(host::nowMs() * 1000ULL); }
+
+void delay(unsigned long ms)
+{
+    if (delayHook)
+        delayHook(ms);
+    else if (!realTime)
+        virtualMs += ms;
+    else
+    {
+        struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000L};
+        nanosleep(&ts, nullptr);
+    }
+}
+
+void yield() {}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin < kPinCount)
+        pinLevels[pin] = val ? HIGH : LOW;
+    if (pinWriteHook)
+        pinWriteHook(pin, val);
+}
+
+int digitalRead(uint8_t pin) { return host::pinLevel(pin); }
+
+int analogRead(uint8_t pin) { return analogSource ? analogSource(pin) : 0; }
+
+size_t HardwareSerial::write(const char *s, size_t n)
+{
+    if (serialEcho)
+        fwrite(s, 1, n, stdout);
+    return n;
+}
+
+size_t HardwareSerial::printf(const char *fmt, ...)
+{
+    if (!serialEcho)
+        return 0;
+    va_list args;
+    va_start(args, fmt);
+    int n = vprintf(fmt, args);
+    va_end(args);
+    return n < 0 ? 0 : (size_t)n;
+}
+
+void EspClass::restart()
+{
+    if (restartHook)
+        restartHook();
+}
+
+uint32_t EspClass::getFreeHeap() { return 0; }
+
+// Replaces the NTP-backed GetEpochTime() from main.cpp
+unsigned long GetEpochTime() { return host::epochNow(); }
@@ -0,0 +1,40 @@
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include <stdint.h>
+#include <functional>
+
+// Hooks behind the host Arduino core. Tools built on the host layer use
+// them to script the clock, the ADC and the side effects of the firmware.
+namespace host
+{
+    // Clock: virtual by default (only moves on advanceTime()/delay()),
+    // or bound to the Linux monotonic clock with useRealTime().
+    void useRealTime(bool enabled);
+    uint64_t nowMs();
+    void setTimeMs(uint64_t ms);
+    void advanceTime(uint64_t ms);
+
+    // Wall clock base used by GetEpochTime() replacements.
+    void setEpochBase(uint32_t epoch);
+    uint32_t epochNow();
+
+    // GPIO / ADC
+    void setAnalogSource(std::function<int(uint8_t pin)> source);
+    void setPinWriteHook(std::function<void(uint8_t pin, uint8_t val)> hook);
+    int pinLevel(uint8_t pin);
+    void resetPins();
+
+    // Pulse counters stand in for PCNT/interrupt-counted inputs
+    void addPulses(uint8_t pin, uint32_t count);
+    uint32_t pulseCount(uint8_t pin);
+
+    // delay() defaults to advancing the virtual clock
+    void setDelayHook(std::function<void(unsigned long ms)> hook);
+    void setRestartHook(std::function<void()> hook);
+
+    // Serial goes to stdout only when echo is on
+    void setSerialEcho(bool enabled);
+}
+
+#endif
@@ -0,0 +1,8 @@
+#include <Arduino.h>
+#include "ota.h"
+
+// Host builds have no flash to update; the command is acknowledged and ignored
+void scheduleOtaPull(const String &url, const String &md5, unsigned long jitterSeconds)
+{
+    Serial.printf("OTA pull ignored on host: %s md5 %s (jitter %lu s)\n", url.c_str(), md5.c_str(), jitterSeconds);
+}
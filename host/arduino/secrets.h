@@ -0,0 +1,11 @@
+#include <cstdint>
+#ifndef SECRETS_H
+#define SECRETS_H
+
+// Host builds talk to a local broker; include/secrets.h takes precedence when present.
+const char *MQTT_SERVER = "127.0.0.1";
+const uint16_t MQTT_PORT = 1883;
+const char *MQTT_USERNAME = "";
+const char *MQTT_PASSWORD = "";
+
+#endif
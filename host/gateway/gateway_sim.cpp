@@ -0,0 +1,368 @@
+// Gateway check on the host: the real gateway.cpp/mqtt.cpp against simulated
+// battery sensor nodes on a lossy link, on a virtual clock.
+//
+// Each node wakes every --wake-s seconds (random phase), sends one reading,
+// listens for the rest of that step and sleeps again. setNodeValve commands
+// are injected on the commands topic and must be acknowledged by the node's
+// next reading. The run fails (exit 1) if a reading is lost between the link
+// and MQTT, a batch does not fit MQTT_MAX_PACKET_SIZE, or a command is left
+// unresolved (neither acked, expired nor superseded).
+//
+// Usage:
+//   program [--nodes N] [--wake-s S] [--hours H] [--loss P] [--dup P]
+//           [--commands N] [--step-ms N] [--seed N] [--echo]
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "globals.h"
+#include "sensors.h"
+#include "mqtt.h"
+#include "gateway.h"
+#include "host_hal.h"
+#include "capture_transport.h"
+#include "sim_link.h"
+
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+
+namespace
+{
+    const unsigned long loopIntervalMs = 2UL * 1000UL; // as in main.cpp
+
+    struct SimNode
+    {
+        NodeAddress address;
+        std::string id;
+        uint64_t nextWakeMs;
+        bool listening;
+        uint16_t seq;
+        int moistureRaw;
+        int batteryMv;
+        bool valveOpen;
+        uint64_t valveCloseAtMs;
+        uint8_t appliedCommandSeq;
+        bool lastCommandOpen;
+    };
+
+    struct Report
+    {
+        unsigned long readingsSent = 0;
+        unsigned long batches = 0;
+        unsigned long batchEntries = 0;
+        size_t largestBatchBytes = 0;
+        unsigned long commandsIssued = 0;
+        unsigned long commandsRejected = 0;
+        unsigned long acks = 0;
+        unsigned long expired = 0;
+        unsigned long superseded = 0;
+        unsigned long publishFailures = 0;
+        std::vector<double> ackLatencyS;
+    };
+
+    std::string nodeId(const NodeAddress &address)
+    {
+        char id[13];
+        snprintf(id, sizeof(id), "%02X%02X%02X%02X%02X%02X", address.mac[0], address.mac[1], address.mac[2],
+                 address.mac[3], address.mac[4], address.mac[5]);
+        return id;
+    }
+
+    // Mirrors setup() in main.cpp minus WiFi, OTA and Alexa
+    void simulatedSetup(SimulatedLink &link)
+    {
+        deviceID = "GATEWAY";
+        deviceIP = "127.0.0.1";
+        topics = {
+            "smartkler/commands/" + deviceID,
+            "smartkler/systemEvents/" + deviceID,
+            "smartkler/data/" + deviceID,
+            "smartkler/valve/" + deviceID,
+            "smartkler/lwt/" + deviceID,
+        };
+
+        pinMode(pinIgro, INPUT);
+        pinMode(pinRelay, OUTPUT);
+        digitalWrite(pinRelay, LOW);
+
+        connectToMQTT();
+        gatewaySetup(link);
+        publishSensorData(true);
+        publishSystemEvent("Smartkler Started", "system_started");
+    }
+
+    // Same order as loop() in main.cpp
+    void gatewayStep(uint32_t &lastLoopTick)
+    {
+        mqttClient.loop();
+        mqttProcessQueue();
+        checkValveWatchdog();
+        processDeferredSensorPublish();
+        processPendingDataRequest();
+        gatewayLoop();
+
+        uint32_t now = millis();
+        if (now - lastSensorInfoPublished >= sensorInfoPublishIntervalMs)
+        {
+            lastSensorInfoPublished = now;
+            publishSensorData();
+        }
+        if (now - lastLoopTick >= loopIntervalMs)
+        {
+            lastLoopTick = now;
+            checkMQTTConnection();
+        }
+    }
+
+    double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty())
+            return 0.0;
+        size_t k = std::min(values.size() - 1, (size_t)(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long nodeCount = 12;
+    unsigned long wakeS = 300;
+    double hours = 24.0;
+    double loss = 0.1;
+    double dup = 0.05;
+    unsigned long commands = 40;
+    unsigned long stepMs = 1000;
+    unsigned long seed = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--nodes" && hasValue)
+            nodeCount = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--wake-s" && hasValue)
+            wakeS = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--hours" && hasValue)
+            hours = atof(argv[++i]);
+        else if (arg == "--loss" && hasValue)
+            loss = atof(argv[++i]);
+        else if (arg == "--dup" && hasValue)
+            dup = atof(argv[++i]);
+        else if (arg == "--commands" && hasValue)
+            commands = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--step-ms" && hasValue)
+            stepMs = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--seed" && hasValue)
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--echo")
+            host::setSerialEcho(true);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--nodes N] [--wake-s S] [--hours H] [--loss P] [--dup P] "
+                            "[--commands N] [--step-ms N] [--seed N] [--echo]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::mt19937 rng(seed);
+    std::bernoulli_distribution lost(std::min(std::max(loss, 0.0), 1.0));
+    std::bernoulli_distribution duplicated(std::min(std::max(dup, 0.0), 1.0));
+    std::uniform_int_distribution<int> rssi(-88, -50);
+
+    host::setTimeMs(0);
+    host::resetPins();
+    host::setAnalogSource([](uint8_t) { return 600; });
+
+    uint64_t wakeMs = wakeS * 1000ULL;
+    uint64_t endMs = (uint64_t)(hours * 3600.0 * 1000.0);
+
+    std::vector<SimNode> nodes(nodeCount);
+    for (unsigned long i = 0; i < nodeCount; i++)
+    {
+        SimNode &node = nodes[i];
+        node = {};
+        uint8_t mac[6] = {0x5C, 0xCF, 0x7F, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+        memcpy(node.address.mac, mac, sizeof(mac));
+        node.id = nodeId(node.address);
+        node.nextWakeMs = std::uniform_int_distribution<uint64_t>(0, wakeMs - 1)(rng);
+        node.moistureRaw = 450 + (int)(rng() % 300);
+        node.batteryMv = 4100;
+    }
+
+    SimulatedLink link;
+    link.lose = [&]() { return lost(rng); };
+    link.deliverToNode = [&](const NodeAddress &to, const uint8_t *data, size_t length) {
+        for (SimNode &node : nodes)
+        {
+            if (memcmp(node.address.mac, to.mac, sizeof(to.mac)) != 0)
+                continue;
+
+            NodeCommandFrame frame;
+            if (!node.listening || length != sizeof(frame) || data[0] != NODE_FRAME_COMMAND)
+                return;
+            memcpy(&frame, data, sizeof(frame));
+
+            node.appliedCommandSeq = frame.commandSeq;
+            node.valveOpen = frame.valveOpen;
+            node.valveCloseAtMs = host::nowMs() + frame.minutes * 60000ULL;
+            return;
+        }
+    };
+
+    Report report;
+    std::set<std::string> knownIds;
+    for (const SimNode &node : nodes)
+        knownIds.insert(node.id);
+
+    CaptureTransport transport;
+    transport.sink = [&](const CapturedMessage &msg) {
+        DynamicJsonDocument doc(4096);
+        if (deserializeJson(doc, msg.payload))
+            return;
+        // Failure reports are published raw, without the envelope
+        JsonVariantConst data = doc.containsKey("data") ? doc["data"] : doc.as<JsonVariantConst>();
+
+        if (msg.topic == topics.data.c_str() && data.containsKey("nodes"))
+        {
+            report.batches++;
+            report.largestBatchBytes = std::max(report.largestBatchBytes, msg.payload.size());
+            for (JsonVariantConst entry : data["nodes"].as<JsonArrayConst>())
+            {
+                if (knownIds.count(entry["node"] | ""))
+                    report.batchEntries++;
+            }
+        }
+        else if (msg.topic == topics.valve.c_str())
+        {
+            const char *result = data["command_result"] | "";
+            if (strcmp(result, "node_valve_on") == 0 || strcmp(result, "node_valve_off") == 0)
+            {
+                report.acks++;
+                report.ackLatencyS.push_back((data["latency_ms"] | 0UL) / 1000.0);
+            }
+            else if (strcmp(result, "node_command_expired") == 0)
+            {
+                report.expired++;
+            }
+            else if (strcmp(result, "node_command_superseded") == 0)
+            {
+                report.superseded++;
+            }
+        }
+        else if (msg.topic == topics.systemEvents.c_str())
+        {
+            const char *code = data["action_code"] | "";
+            if (strcmp(code, "node_command_rejected") == 0)
+                report.commandsRejected++;
+            else if (strcmp(code, "mqtt_publish_failed") == 0 || strcmp(code, "mqtt_payload_overflow") == 0)
+                report.publishFailures++;
+        }
+    };
+    mqttClient.attach(&transport);
+
+    simulatedSetup(link);
+
+    // Commands start once every node has reported and stop early enough to
+    // be acknowledged or expire before the run ends
+    uint64_t firstCommandMs = wakeMs + 60000;
+    uint64_t lastCommandMs = endMs > 2 * 3600000ULL + firstCommandMs ? endMs - 2 * 3600000ULL : firstCommandMs;
+    std::vector<uint64_t> commandTimes;
+    for (unsigned long i = 0; i < commands && nodeCount > 0 && lastCommandMs > firstCommandMs; i++)
+        commandTimes.push_back(std::uniform_int_distribution<uint64_t>(firstCommandMs, lastCommandMs)(rng));
+    std::sort(commandTimes.begin(), commandTimes.end());
+
+    // Nodes stop waking at endMs; the tail lets the last batch and acks drain
+    uint64_t drainMs = endMs + 2 * 3600000ULL;
+    size_t nextCommand = 0;
+    uint32_t lastLoopTick = 0;
+
+    while (host::nowMs() <= drainMs)
+    {
+        uint64_t now = host::nowMs();
+
+        for (; nextCommand < commandTimes.size() && commandTimes[nextCommand] <= now; nextCommand++)
+        {
+            SimNode &node = nodes[rng() % nodes.size()];
+            node.lastCommandOpen = !node.lastCommandOpen;
+            std::string payload = std::string("{\"command\":\"setNodeValve\",\"node\":\"") + node.id +
+                                  "\",\"state\":\"" + (node.lastCommandOpen ? "on" : "off") + "\",\"minutes\":10}";
+            transport.inject(topics.commands.c_str(), payload);
+            report.commandsIssued++;
+        }
+
+        for (SimNode &node : nodes)
+        {
+            if (node.valveOpen && now >= node.valveCloseAtMs)
+                node.valveOpen = false;
+            if (now >= endMs || now < node.nextWakeMs)
+                continue;
+
+            node.nextWakeMs += wakeMs;
+            node.listening = true;
+            node.seq++;
+            node.moistureRaw = std::min(1023, std::max(0, node.moistureRaw + (int)(rng() % 21) - 10));
+            node.batteryMv = std::max(3300, node.batteryMv - (int)(rng() % 2));
+
+            NodeReadingFrame frame = {NODE_FRAME_READING, nodeProtocolVersion, node.seq, (uint16_t)node.moistureRaw,
+                                      (uint16_t)node.batteryMv, (uint8_t)node.valveOpen, node.appliedCommandSeq};
+            int8_t level = (int8_t)rssi(rng);
+            link.transmit(node.address, (const uint8_t *)&frame, sizeof(frame), level);
+            report.readingsSent++;
+
+            // A lost MAC-level ack makes the radio send the same frame again
+            if (duplicated(rng))
+                link.transmit(node.address, (const uint8_t *)&frame, sizeof(frame), level);
+        }
+
+        gatewayStep(lastLoopTick);
+
+        for (SimNode &node : nodes)
+            node.listening = false;
+
+        host::advanceTime(stepMs);
+    }
+
+    const GatewayStats &stats = gatewayStats();
+    unsigned long accepted = report.commandsIssued - report.commandsRejected - commandStats.rateLimited;
+
+    printf("nodes %zu/%lu (%lu evicted, %lu refused), readings sent %lu, received %lu (%lu duplicates, "
+           "%lu lost frames of %lu)\n",
+           gatewayNodeCount(), nodeCount, stats.nodesEvicted, stats.tableFull, report.readingsSent, stats.readings,
+           stats.duplicates, link.framesLost, link.framesToGateway + link.framesToNodes);
+    printf("batches %lu, readings per publish %.2f, largest batch %zu bytes (limit %d)\n",
+           report.batches, report.batches ? (double)report.batchEntries / report.batches : 0.0,
+           report.largestBatchBytes, MQTT_MAX_PACKET_SIZE);
+    printf("commands issued %lu, rejected %lu, acked %lu, expired %lu, superseded %lu, frames sent %lu; "
+           "ack latency s p50=%.0f p90=%.0f max=%.0f\n",
+           report.commandsIssued, report.commandsRejected, report.acks, report.expired, report.superseded,
+           stats.commandsSent,
+           percentile(report.ackLatencyS, 0.5), percentile(report.ackLatencyS, 0.9),
+           percentile(report.ackLatencyS, 1.0));
+
+    int exitCode = 0;
+    if (report.batchEntries + stats.readingsReplaced != stats.readings)
+    {
+        printf("FAIL: %lu readings received but %lu published (%lu replaced)\n", stats.readings,
+               report.batchEntries, stats.readingsReplaced);
+        exitCode = 1;
+    }
+    if (report.largestBatchBytes > MQTT_MAX_PACKET_SIZE || report.publishFailures > 0)
+    {
+        printf("FAIL: batch publish exceeded the packet size\n");
+        exitCode = 1;
+    }
+    unsigned long resolved = report.acks + report.expired + report.superseded;
+    if (resolved != accepted)
+    {
+        printf("FAIL: %lu commands accepted, %lu acked, expired or superseded\n", accepted, resolved);
+        exitCode = 1;
+    }
+    return exitCode;
+}
@@ -0,0 +1,72 @@
+#ifndef SIM_LINK_H
+#define SIM_LINK_H
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include "node_link.h"
+
+// In-memory radio between the gateway and simulated nodes. Every frame,
+// in either direction, goes through the same loss decision.
+class SimulatedLink : public NodeLink
+{
+public:
+    std::function<bool()> lose;
+    std::function<void(const NodeAddress &to, const uint8_t *data, size_t length)> deliverToNode;
+
+    unsigned long framesToGateway = 0;
+    unsigned long framesToNodes = 0;
+    unsigned long framesLost = 0;
+    std::vector<NodeAddress> forgotten;
+
+    // Node -> gateway
+    void transmit(const NodeAddress &from, const uint8_t *data, size_t length, int8_t rssi)
+    {
+        framesToGateway++;
+        if (length > nodeMaxFrameBytes || (lose && lose()))
+        {
+            framesLost++;
+            return;
+        }
+
+        NodePacket packet = {};
+        packet.from = from;
+        packet.rssi = rssi;
+        packet.length = (uint8_t)length;
+        memcpy(packet.data, data, length);
+        inbound.push_back(packet);
+    }
+
+    bool begin() override { return true; }
+
+    // Gateway -> node. Like ESP-NOW without a MAC-level ack, a lost frame
+    // still counts as sent; the node's next reading tells the real outcome.
+    bool send(const NodeAddress &to, const uint8_t *data, size_t length) override
+    {
+        framesToNodes++;
+        if (lose && lose())
+        {
+            framesLost++;
+            return true;
+        }
+        if (deliverToNode)
+            deliverToNode(to, data, length);
+        return true;
+    }
+
+    bool receive(NodePacket &packet) override
+    {
+        if (inbound.empty())
+            return false;
+        packet = inbound.front();
+        inbound.pop_front();
+        return true;
+    }
+
+    void forget(const NodeAddress &address) override { forgotten.push_back(address); }
+
+private:
+    std::deque<NodePacket> inbound;
+};
+
+#endif
@@ -0,0 +1,509 @@
+// Fleet load generator: thousands of virtual smartkler nodes running the real
+// mqtt.cpp/sensors.cpp code against a broker, one socket per node.
+//
+// The firmware keeps its state in globals, so the nodes are scheduled
+// cooperatively on one thread and each node's slice of that state is swapped
+// in before its turn and saved after it. Calibration, interval settings and
+// the moisture trend history are shared by the whole fleet.
+//
+// Usage:
+//   program [--broker host] [--port N] [--user u] [--pass p] [--devices N] [--ramp N/s]
+//           [--duration s] [--telemetry-ms N] [--ping-ms N] [--ping-timeout-ms N] [--drop-at s]
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "globals.h"
+#include "sensors.h"
+#include "mqtt.h"
+#include "command_admission.h"
+#include "mqtt_queue.h"
+#include "host_hal.h"
+#include "socket_transport.h"
+
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+
+// Deferred publish state from sensors.cpp, swapped per node
+extern bool sensorPublishPending;
+extern unsigned long sensorPublishDueTime;
+
+namespace
+{
+    const unsigned long loopIntervalMs = 2UL * 1000UL; // as in main.cpp
+
+    // Ping round trips in 1 ms buckets. A ping that has not come back within
+    // the timeout counts as lost, so no sample lands past the last bucket.
+    class LatencyHistogram
+    {
+    public:
+        explicit LatencyHistogram(unsigned long maxMs) : buckets(maxMs + 1, 0) {}
+
+        void add(unsigned long ms)
+        {
+            buckets[std::min(ms, (unsigned long)buckets.size() - 1)]++;
+            samples++;
+        }
+
+        void merge(const LatencyHistogram &other)
+        {
+            for (size_t i = 0; i < buckets.size(); i++)
+                buckets[i] += other.buckets[i];
+            samples += other.samples;
+            lost += other.lost;
+        }
+
+        void reset()
+        {
+            std::fill(buckets.begin(), buckets.end(), 0);
+            samples = 0;
+            lost = 0;
+        }
+
+        double percentile(double p) const
+        {
+            if (samples == 0)
+                return 0.0;
+            uint64_t rank = std::min(samples - 1, (uint64_t)(p * samples));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < buckets.size(); i++)
+            {
+                seen += buckets[i];
+                if (seen > rank)
+                    return (double)i;
+            }
+            return (double)(buckets.size() - 1);
+        }
+
+        uint64_t samples = 0;
+        uint64_t lost = 0;
+
+    private:
+        std::vector<uint64_t> buckets;
+    };
+
+    struct FleetStats
+    {
+        uint64_t published = 0;
+        uint64_t publishedBytes = 0;
+        uint64_t commands = 0;
+        uint64_t connectAttempts = 0;
+        uint64_t connectFailures = 0;
+        uint64_t reboots = 0;
+    };
+
+    FleetStats stats;
+
+    // Counts traffic on top of the plain socket transport
+    class CountingTransport : public SocketTransport
+    {
+    public:
+        bool connect(const MqttConnectOptions &options) override
+        {
+            stats.connectAttempts++;
+            bool ok = SocketTransport::connect(options);
+            if (!ok)
+                stats.connectFailures++;
+            return ok;
+        }
+
+        bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained) override
+        {
+            bool ok = SocketTransport::publish(topic, payload, length, retained);
+            if (ok)
+            {
+                stats.published++;
+                stats.publishedBytes += length;
+            }
+            return ok;
+        }
+
+        bool loop(const MqttCallback &callback) override
+        {
+            return SocketTransport::loop([&](char *topic, uint8_t *payload, unsigned int length) {
+                stats.commands++;
+                callback(topic, payload, length);
+            });
+        }
+    };
+
+    struct VirtualDevice
+    {
+        String id;
+        String commandTopic;
+        CountingTransport transport;
+        unsigned long startAt = 0;
+        uint32_t sleepUntil = 0;
+        uint32_t lastLoopTick = 0;
+        bool booted = false;
+        bool started = false;
+
+        // Saved firmware globals
+        Topics topics;
+        unsigned long valveDurationMs = 0;
+        float valveTargetLiters = 0;
+        unsigned long lastValveStartTime = 0;
+        unsigned long lastSensorInfoPublished = 0;
+        unsigned long lastMoistureReadTime = 0;
+        SoilReadingDoc lastMoistureData;
+        bool sensorPublishPending = false;
+        unsigned long sensorPublishDueTime = 0;
+        uint8_t relayLevel = LOW;
+        CommandAdmissionState admission = {};
+        MqttQueueState queue = {};
+    };
+
+    std::vector<std::unique_ptr<VirtualDevice>> fleet;
+    VirtualDevice *current = nullptr;
+
+    void activate(VirtualDevice &dev)
+    {
+        current = &dev;
+        deviceID = dev.id;
+        deviceID.toUpperCase();
+        topics = dev.topics;
+        valveDurationMs = dev.valveDurationMs;
+        valveTargetLiters = dev.valveTargetLiters;
+        lastValveStartTime = dev.lastValveStartTime;
+        lastSensorInfoPublished = dev.lastSensorInfoPublished;
+        lastMoistureReadTime = dev.lastMoistureReadTime;
+        lastMoistureData = dev.lastMoistureData;
+        sensorPublishPending = dev.sensorPublishPending;
+        sensorPublishDueTime = dev.sensorPublishDueTime;
+        digitalWrite(pinRelay, dev.relayLevel);
+        commandAdmission = dev.admission;
+        mqttQueue = dev.queue;
+        mqttClient.attach(&dev.transport);
+    }
+
+    void deactivate(VirtualDevice &dev)
+    {
+        dev.topics = topics;
+        dev.valveDurationMs = valveDurationMs;
+        dev.valveTargetLiters = valveTargetLiters;
+        dev.lastValveStartTime = lastValveStartTime;
+        dev.lastSensorInfoPublished = lastSensorInfoPublished;
+        dev.lastMoistureReadTime = lastMoistureReadTime;
+        dev.lastMoistureData = lastMoistureData;
+        dev.sensorPublishPending = sensorPublishPending;
+        dev.sensorPublishDueTime = sensorPublishDueTime;
+        dev.relayLevel = (uint8_t)digitalRead(pinRelay);
+        dev.admission = commandAdmission;
+        dev.queue = mqttQueue; // the device owns its queued blocks until its next turn
+        mqttQueue = {};
+        mqttClient.attach(nullptr);
+        current = nullptr;
+    }
+
+    // Mirrors setup() in main.cpp minus WiFi, OTA and Alexa
+    void boot(VirtualDevice &dev)
+    {
+        topics = {
+            "smartkler/commands/" + deviceID,
+            "smartkler/systemEvents/" + deviceID,
+            "smartkler/data/" + deviceID,
+            "smartkler/valve/" + deviceID,
+            "smartkler/lwt/" + deviceID,
+        };
+        digitalWrite(pinRelay, LOW);
+        sensorPublishPending = false;
+
+        connectToMQTT();
+        publishSensorData(true);
+        publishSystemEvent("Smartkler Started", "system_started");
+
+        dev.booted = true;
+        dev.lastLoopTick = millis();
+        lastSensorInfoPublished = millis();
+    }
+
+    // Mirrors loop() in main.cpp
+    void step(VirtualDevice &dev)
+    {
+        uint32_t now = millis();
+
+        mqttClient.loop();
+        mqttProcessQueue();
+        checkValveWatchdog();
+        processDeferredSensorPublish();
+        processPendingDataRequest();
+
+        if (now - lastSensorInfoPublished >= sensorInfoPublishIntervalMs)
+        {
+            lastSensorInfoPublished = now;
+            publishSensorData();
+        }
+
+        if (now - dev.lastLoopTick >= loopIntervalMs)
+        {
+            dev.lastLoopTick = now;
+            checkMQTTConnection();
+        }
+    }
+
+    void raiseFdLimit()
+    {
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+        {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+}
+
+// One chip ID per virtual node
+String getDeviceId()
+{
+    return current ? current->id : String("loadgen");
+}
+
+int main(int argc, char **argv)
+{
+    std::string broker = "127.0.0.1";
+    uint16_t port = 1883;
+    std::string user;
+    std::string pass;
+    unsigned long devices = 100;
+    unsigned long rampPerSecond = 200;
+    unsigned long durationS = 60;
+    unsigned long telemetryMs = 10000;
+    unsigned long pingMs = 20;
+    unsigned long pingTimeoutMs = 5000;
+    long dropAtS = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--broker" && hasValue)
+            broker = argv[++i];
+        else if (arg == "--port" && hasValue)
+            port = (uint16_t)atoi(argv[++i]);
+        else if (arg == "--user" && hasValue)
+            user = argv[++i];
+        else if (arg == "--pass" && hasValue)
+            pass = argv[++i];
+        else if (arg == "--devices" && hasValue)
+            devices = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--ramp" && hasValue)
+            rampPerSecond = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--duration" && hasValue)
+            durationS = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--telemetry-ms" && hasValue)
+            telemetryMs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--ping-ms" && hasValue)
+            pingMs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--ping-timeout-ms" && hasValue)
+            pingTimeoutMs = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--drop-at" && hasValue)
+            dropAtS = atol(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--broker host] [--port N] [--user u] [--pass p] [--devices N] [--ramp N/s] "
+                            "[--duration s] [--telemetry-ms N] [--ping-ms N] [--ping-timeout-ms N] [--drop-at s]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    raiseFdLimit();
+    host::useRealTime(true);
+    host::setEpochBase((uint32_t)time(nullptr));
+    host::setAnalogSource([](uint8_t) { return 450 + rand() % 300; });
+    host::setDelayHook([](unsigned long ms) {
+        // A blocking delay() only stalls the node that called it
+        if (current)
+            current->sleepUntil = millis() + ms;
+    });
+    host::setRestartHook([]() {
+        stats.reboots++;
+        if (!current)
+            return;
+        current->transport.abort(); // broker publishes the LWT
+        current->booted = false;
+        mqttQueueClear(); // RAM does not survive a reboot
+    });
+
+    sensorInfoPublishIntervalMs = telemetryMs;
+
+    std::map<std::string, VirtualDevice *> byTopicId;
+    for (unsigned long i = 0; i < devices; i++)
+    {
+        std::unique_ptr<VirtualDevice> dev(new VirtualDevice());
+        char id[9];
+        snprintf(id, sizeof(id), "%06lx", 0xA00000UL + i);
+        dev->id = id;
+        dev->startAt = i * 1000UL / rampPerSecond;
+        dev->transport.setBroker(broker, port);
+        dev->transport.setCredentials(user, pass);
+
+        String upper = dev->id;
+        upper.toUpperCase();
+        dev->commandTopic = "smartkler/commands/" + upper;
+        byTopicId[upper.c_str()] = dev.get();
+        fleet.push_back(std::move(dev));
+    }
+
+    // Controller: pings nodes round-robin and times the PONG system event.
+    // A node is pinged again once its previous ping was answered or expired.
+    SocketTransport controller;
+    controller.setBroker(broker, port);
+    std::map<VirtualDevice *, unsigned long> outstandingPings;
+    LatencyHistogram intervalPings(pingTimeoutMs);
+    LatencyHistogram totalPings(pingTimeoutMs);
+    MqttConnectOptions controllerOptions = {broker.c_str(), port, "smartkler-loadgen", user.c_str(), pass.c_str(),
+                                            nullptr, 0, false, nullptr, 30};
+    if (!controller.connect(controllerOptions))
+    {
+        fprintf(stderr, "Controller cannot connect to %s:%u (rc=%d)\n", broker.c_str(), port, controller.state());
+        return 1;
+    }
+    controller.subscribe("smartkler/systemEvents/+", 0);
+    MqttCallback onSystemEvent = [&](char *topic, uint8_t *payload, unsigned int length) {
+        const char *slash = strrchr(topic, '/');
+        if (!slash || !memmem(payload, length, "ping_response", 13))
+            return;
+        auto dev = byTopicId.find(slash + 1);
+        if (dev == byTopicId.end())
+            return;
+        auto sent = outstandingPings.find(dev->second);
+        if (sent == outstandingPings.end())
+            return;
+        intervalPings.add(millis() - sent->second);
+        outstandingPings.erase(sent);
+    };
+
+    printf("%6s %11s %9s %9s %8s %8s %8s %8s %8s %8s %6s\n",
+           "t(s)", "connected", "pub/s", "cmd/s", "conn", "fail", "p50ms", "p90ms", "p99ms", "maxms", "lost");
+
+    unsigned long startMs = millis();
+    unsigned long lastReportMs = startMs;
+    unsigned long lastPingMs = startMs;
+    size_t pingCursor = 0;
+    bool dropped = false;
+    FleetStats lastReport;
+    unsigned long stormStartMs = 0;
+    unsigned long longestStormMs = 0;
+
+    while (millis() - startMs < durationS * 1000UL)
+    {
+        uint32_t now = millis();
+
+        if (!dropped && dropAtS >= 0 && now - startMs >= (unsigned long)dropAtS * 1000UL)
+        {
+            // Simulated network outage: every node loses its socket at once
+            dropped = true;
+            for (auto &dev : fleet)
+                dev->transport.abort();
+        }
+
+        size_t connected = 0;
+        for (auto &devPtr : fleet)
+        {
+            VirtualDevice &dev = *devPtr;
+            if (now - startMs < dev.startAt || (int32_t)(now - dev.sleepUntil) < 0)
+            {
+                connected += dev.transport.connected();
+                continue;
+            }
+
+            activate(dev);
+            if (!dev.booted)
+                boot(dev);
+            else
+                step(dev);
+            deactivate(dev);
+
+            connected += dev.transport.connected();
+        }
+
+        controller.loop(onSystemEvent);
+
+        // Lost on the wire, dropped by the node's admission control, or the
+        // node rebooted before answering
+        for (auto ping = outstandingPings.begin(); ping != outstandingPings.end();)
+        {
+            if (now - ping->second >= pingTimeoutMs)
+            {
+                intervalPings.lost++;
+                ping = outstandingPings.erase(ping);
+            }
+            else
+                ++ping;
+        }
+
+        if (pingMs > 0 && now - lastPingMs >= pingMs && !fleet.empty())
+        {
+            lastPingMs = now;
+            VirtualDevice *dev = fleet[pingCursor++ % fleet.size()].get();
+            if (dev->transport.connected() && !outstandingPings.count(dev))
+            {
+                const char *ping = "{\"command\":\"ping\"}";
+                if (controller.publish(dev->commandTopic.c_str(), (const uint8_t *)ping, strlen(ping), false))
+                    outstandingPings[dev] = now;
+            }
+        }
+
+        // Reconnect storm: from the first lost node until the whole fleet is back
+        bool rampDone = now - startMs >= fleet.size() * 1000UL / rampPerSecond;
+        if (rampDone && connected < fleet.size() && stormStartMs == 0)
+            stormStartMs = now;
+        if (stormStartMs != 0 && connected == fleet.size())
+        {
+            longestStormMs = std::max(longestStormMs, now - stormStartMs);
+            printf("reconnect storm resolved in %lu ms\n", now - stormStartMs);
+            stormStartMs = 0;
+        }
+
+        // Percentiles per line cover only the last interval; the summary covers the run
+        if (now - lastReportMs >= 1000UL)
+        {
+            double secs = (now - lastReportMs) / 1000.0;
+            printf("%6lu %5zu/%-5zu %9.0f %9.0f %8llu %8llu %8.1f %8.1f %8.1f %8.1f %6llu\n",
+                   (now - startMs) / 1000UL, connected, fleet.size(),
+                   (stats.published - lastReport.published) / secs,
+                   (stats.commands - lastReport.commands) / secs,
+                   (unsigned long long)stats.connectAttempts, (unsigned long long)stats.connectFailures,
+                   intervalPings.percentile(0.50), intervalPings.percentile(0.90),
+                   intervalPings.percentile(0.99), intervalPings.percentile(1.0),
+                   (unsigned long long)intervalPings.lost);
+            fflush(stdout);
+            totalPings.merge(intervalPings);
+            intervalPings.reset();
+            lastReport.published = stats.published;
+            lastReport.commands = stats.commands;
+            lastReportMs = now;
+        }
+
+        usleep(200);
+    }
+
+    totalPings.merge(intervalPings);
+
+    double totalS = (millis() - startMs) / 1000.0;
+    printf("\nnodes %zu, %.0f s: %llu publishes (%.0f/s, %.1f KiB/s), %llu commands, "
+           "%llu connects (%llu failed), %llu reboots, %lu queued messages dropped\n",
+           fleet.size(), totalS, (unsigned long long)stats.published, stats.published / totalS,
+           stats.publishedBytes / 1024.0 / totalS, (unsigned long long)stats.commands,
+           (unsigned long long)stats.connectAttempts, (unsigned long long)stats.connectFailures,
+           (unsigned long long)stats.reboots, mqttQueueStats().dropped);
+    printf("ping latency ms: n=%llu lost=%llu (timeout %lu ms) p50=%.1f p90=%.1f p99=%.1f max=%.1f; "
+           "longest reconnect storm %lu ms%s\n",
+           (unsigned long long)totalPings.samples, (unsigned long long)totalPings.lost, pingTimeoutMs,
+           totalPings.percentile(0.50), totalPings.percentile(0.90), totalPings.percentile(0.99),
+           totalPings.percentile(1.0), longestStormMs, stormStartMs ? " (still running)" : "");
+
+    for (auto &dev : fleet)
+        dev->transport.disconnect();
+    controller.disconnect();
+    return 0;
+}
@@ -0,0 +1,354 @@
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "socket_transport.h"
+
+namespace
+{
+    void putLength(std::vector<uint8_t> &out, size_t length)
+    {
+        do
+        {
+            uint8_t digit = length % 128;
+            length /= 128;
+            if (length > 0)
+                digit |= 0x80;
+            out.push_back(digit);
+        } while (length > 0);
+    }
+
+    void putString(std::vector<uint8_t> &out, const char *s, size_t n)
+    {
+        out.push_back((uint8_t)(n >> 8));
+        out.push_back((uint8_t)(n & 0xFF));
+        out.insert(out.end(), s, s + n);
+    }
+
+    void putString(std::vector<uint8_t> &out, const char *s)
+    {
+        putString(out, s, strlen(s));
+    }
+
+    std::vector<uint8_t> makePacket(uint8_t header, const std::vector<uint8_t> &body)
+    {
+        std::vector<uint8_t> packet;
+        packet.reserve(body.size() + 5);
+        packet.push_back(header);
+        putLength(packet, body.size());
+        packet.insert(packet.end(), body.begin(), body.end());
+        return packet;
+    }
+
+    // Returns the full packet size if `buf` holds a complete packet, 0 otherwise
+    size_t completePacketSize(const std::vector<uint8_t> &buf, size_t &headerSize, size_t &bodySize)
+    {
+        size_t length = 0;
+        size_t multiplier = 1;
+        for (size_t i = 1; i < buf.size() && i <= 4; i++)
+        {
+            length += (buf[i] & 0x7F) * multiplier;
+            multiplier *= 128;
+            if (!(buf[i] & 0x80))
+            {
+                headerSize = i + 1;
+                bodySize = length;
+                return buf.size() >= headerSize + bodySize ? headerSize + bodySize : 0;
+            }
+        }
+        return 0;
+    }
+}
+
+SocketTransport::~SocketTransport()
+{
+    abort();
+}
+
+void SocketTransport::setBroker(const std::string &host, uint16_t port)
+{
+    brokerHost = host;
+    brokerPort = port;
+}
+
+void SocketTransport::setCredentials(const std::string &user, const std::string &pass)
+{
+    brokerUser = user;
+    brokerPass = pass;
+}
+
+void SocketTransport::fail(int newState)
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    rx.clear();
+    txPending.clear();
+    lastState = newState;
+}
+
+void SocketTransport::abort()
+{
+    fail(MQTT_CONNECTION_LOST);
+}
+
+bool SocketTransport::connect(const MqttConnectOptions &options)
+{
+    abort();
+
+    std::string host = brokerHost.empty() ? (options.host ? options.host : "127.0.0.1") : brokerHost;
+    uint16_t port = brokerPort ? brokerPort : options.port;
+
+    struct addrinfo hints = {};
+    struct addrinfo *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    char portStr[8];
+    snprintf(portStr, sizeof(portStr), "%u", port);
+    if (getaddrinfo(host.c_str(), portStr, &hints, &res) != 0 || !res)
+    {
+        lastState = MQTT_CONNECT_FAILED;
+        return false;
+    }
+
+    fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        freeaddrinfo(res);
+        lastState = MQTT_CONNECT_FAILED;
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int rc = ::connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (rc != 0 && errno != EINPROGRESS)
+    {
+        fail(MQTT_CONNECT_FAILED);
+        return false;
+    }
+
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    int soError = 0;
+    socklen_t soLen = sizeof(soError);
+    if (poll(&pfd, 1, connectTimeoutMs) != 1 ||
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &soError, &soLen) != 0 || soError != 0)
+    {
+        fail(MQTT_CONNECT_FAILED);
+        return false;
+    }
+
+    keepAliveS = options.keepAlive;
+
+    std::vector<uint8_t> body;
+    putString(body, "MQTT");
+    body.push_back(4); // protocol level 3.1.1
+
+    const char *user = brokerUser.empty() ? options.user : brokerUser.c_str();
+    const char *pass = brokerUser.empty() ? options.pass : brokerPass.c_str();
+    bool hasUser = user && *user;
+    bool hasPass = hasUser && pass && *pass;
+    bool hasWill = options.willTopic && options.willMessage;
+    uint8_t flags = 0x02; // clean session
+    if (hasWill)
+        flags |= 0x04 | ((options.willQos & 0x03) << 3) | (options.willRetain ? 0x20 : 0);
+    if (hasUser)
+        flags |= 0x80;
+    if (hasPass)
+        flags |= 0x40;
+    body.push_back(flags);
+    body.push_back((uint8_t)(keepAliveS >> 8));
+    body.push_back((uint8_t)(keepAliveS & 0xFF));
+
+    putString(body, options.clientId);
+    if (hasWill)
+    {
+        putString(body, options.willTopic);
+        putString(body, options.willMessage);
+    }
+    if (hasUser)
+        putString(body, user);
+    if (hasPass)
+        putString(body, pass);
+
+    std::vector<uint8_t> connack;
+    if (!sendPacket(makePacket(0x10, body)) || !flush() || !readPacket(connack, connectTimeoutMs))
+    {
+        fail(MQTT_CONNECTION_TIMEOUT);
+        return false;
+    }
+
+    if (connack.size() < 4 || connack[0] != 0x20 || connack[3] != 0)
+    {
+        fail(connack.size() >= 4 ? connack[3] : MQTT_CONNECT_FAILED);
+        return false;
+    }
+
+    lastState = MQTT_CONNECTED;
+    return true;
+}
+
+void SocketTransport::disconnect()
+{
+    if (fd >= 0)
+    {
+        sendPacket({0xE0, 0x00});
+        flush();
+    }
+    fail(MQTT_DISCONNECTED);
+}
+
+bool SocketTransport::sendPacket(const std::vector<uint8_t> &packet)
+{
+    if (fd < 0)
+        return false;
+
+    // Keep ordering: queue behind anything not yet written
+    if (!txPending.empty())
+    {
+        txPending.insert(txPending.end(), packet.begin(), packet.end());
+        return flush();
+    }
+
+    ssize_t sent = send(fd, packet.data(), packet.size(), MSG_NOSIGNAL);
+    if (sent < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            fail(MQTT_CONNECTION_LOST);
+            return false;
+        }
+        sent = 0;
+    }
+    if ((size_t)sent < packet.size())
+        txPending.insert(txPending.end(), packet.begin() + sent, packet.end());
+
+    lastTxMs = millis();
+    return true;
+}
+
+bool SocketTransport::flush()
+{
+    while (fd >= 0 && !txPending.empty())
+    {
+        ssize_t sent = send(fd, txPending.data(), txPending.size(), MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            fail(MQTT_CONNECTION_LOST);
+            return false;
+        }
+        txPending.erase(txPending.begin(), txPending.begin() + sent);
+    }
+    return fd >= 0;
+}
+
+bool SocketTransport::readPacket(std::vector<uint8_t> &packet, int timeoutMs)
+{
+    uint8_t buf[512];
+    uint32_t deadline = millis() + (uint32_t)timeoutMs;
+
+    while (fd >= 0)
+    {
+        size_t headerSize = 0, bodySize = 0;
+        size_t size = completePacketSize(rx, headerSize, bodySize);
+        if (size > 0)
+        {
+            packet.assign(rx.begin(), rx.begin() + size);
+            rx.erase(rx.begin(), rx.begin() + size);
+            return true;
+        }
+
+        ssize_t got = recv(fd, buf, sizeof(buf), 0);
+        if (got > 0)
+        {
+            rx.insert(rx.end(), buf, buf + got);
+            continue;
+        }
+        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            fail(MQTT_CONNECTION_LOST);
+            return false;
+        }
+        if (timeoutMs == 0)
+            return false;
+
+        int32_t remaining = (int32_t)(deadline - millis());
+        if (remaining <= 0)
+            return false;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        poll(&pfd, 1, (int)remaining);
+    }
+    return false;
+}
+
+bool SocketTransport::publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained)
+{
+    std::vector<uint8_t> body;
+    body.reserve(strlen(topic) + 2 + length);
+    putString(body, topic);
+    body.insert(body.end(), payload, payload + length);
+    return sendPacket(makePacket(0x30 | (retained ? 0x01 : 0x00), body));
+}
+
+bool SocketTransport::subscribe(const char *topic, uint8_t qos)
+{
+    std::vector<uint8_t> body;
+    uint16_t id = nextPacketId++;
+    if (nextPacketId == 0)
+        nextPacketId = 1;
+    body.push_back((uint8_t)(id >> 8));
+    body.push_back((uint8_t)(id & 0xFF));
+    putString(body, topic);
+    body.push_back(qos & 0x01);
+    return sendPacket(makePacket(0x82, body));
+}
+
+bool SocketTransport::loop(const MqttCallback &callback)
+{
+    if (!flush())
+        return false;
+
+    if (keepAliveS > 0 && millis() - lastTxMs >= keepAliveS * 1000UL / 2)
+        sendPacket({0xC0, 0x00});
+
+    std::vector<uint8_t> packet;
+    while (readPacket(packet, 0))
+    {
+        uint8_t type = packet[0] & 0xF0;
+        if (type != 0x30 || !callback)
+            continue; // SUBACK, PINGRESP, ...
+
+        size_t headerSize = 0, bodySize = 0;
+        completePacketSize(packet, headerSize, bodySize);
+        if (bodySize < 2)
+            continue;
+
+        uint8_t *body = packet.data() + headerSize;
+        size_t topicLen = ((size_t)body[0] << 8) | body[1];
+        size_t offset = 2 + topicLen;
+        if ((packet[0] & 0x06) != 0)
+            offset += 2; // QoS > 0 carries a packet id
+        if (offset > bodySize)
+            continue;
+
+        // Hand out mutable, NUL-terminated copies like PubSubClient's own buffer
+        std::vector<char> topic((char *)body + 2, (char *)body + 2 + topicLen);
+        topic.push_back('\0');
+        std::vector<uint8_t> payload(body + offset, body + bodySize);
+        unsigned int payloadLen = (unsigned int)payload.size();
+        payload.push_back('\0');
+        callback(topic.data(), payload.data(), payloadLen);
+    }
+
+    return fd >= 0;
+}
@@ -0,0 +1,53 @@
+#ifndef SOCKET_TRANSPORT_H
+#define SOCKET_TRANSPORT_H
+
+#include <PubSubClient.h>
+#include <string>
+#include <vector>
+
+// Minimal MQTT 3.1.1 client over a non-blocking POSIX socket (QoS 0 only).
+// Connect is blocking with a timeout; publish/loop never block.
+class SocketTransport : public HostMqttTransport
+{
+public:
+    ~SocketTransport() override;
+
+    // Overrides the host/port passed to PubSubClient::setServer()
+    void setBroker(const std::string &host, uint16_t port);
+    // Overrides the credentials compiled into mqtt.cpp when set
+    void setCredentials(const std::string &user, const std::string &pass);
+    void setConnectTimeoutMs(int ms) { connectTimeoutMs = ms; }
+    // Drops the socket without DISCONNECT so the broker fires the LWT
+    void abort();
+
+    bool connect(const MqttConnectOptions &options) override;
+    void disconnect() override;
+    bool connected() override { return fd >= 0; }
+    int state() override { return lastState; }
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained) override;
+    bool subscribe(const char *topic, uint8_t qos) override;
+    bool loop(const MqttCallback &callback) override;
+
+    size_t pendingTxBytes() const { return txPending.size(); }
+
+private:
+    bool sendPacket(const std::vector<uint8_t> &packet);
+    bool flush();
+    bool readPacket(std::vector<uint8_t> &packet, int timeoutMs);
+    void fail(int newState);
+
+    int fd = -1;
+    int lastState = MQTT_DISCONNECTED;
+    int connectTimeoutMs = 3000;
+    uint16_t keepAliveS = 15;
+    uint16_t nextPacketId = 1;
+    unsigned long lastTxMs = 0;
+    std::string brokerHost;
+    uint16_t brokerPort = 0;
+    std::string brokerUser;
+    std::string brokerPass;
+    std::vector<uint8_t> rx;
+    std::vector<uint8_t> txPending;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef CAPTURE_TRANSPORT_H
+#define CAPTURE_TRANSPORT_H
+
+#include <PubSubClient.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct CapturedMessage
+{
+    unsigned long atMs;
+    std::string topic;
+    std::string payload;
+    bool retained;
+};
+
+// MQTT transport that never touches the network: publishes are handed to
+// a sink and inbound commands are queued by the caller and delivered on loop().
+class CaptureTransport : public HostMqttTransport
+{
+public:
+    std::function<void(const CapturedMessage &)> sink;
+
+    void inject(const std::string &topic, const std::string &payload)
+    {
+        inbound.push_back({millis(), topic, payload, false});
+    }
+
+    bool connect(const MqttConnectOptions &) override
+    {
+        isConnected = true;
+        return true;
+    }
+    void disconnect() override { isConnected = false; }
+    bool connected() override { return isConnected; }
+    int state() override { return isConnected ? MQTT_CONNECTED : MQTT_DISCONNECTED; }
+
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained) override
+    {
+        if (sink)
+            sink({millis(), topic, std::string((const char *)payload, length), retained});
+        return true;
+    }
+
+    bool subscribe(const char *, uint8_t) override { return true; }
+
+    bool loop(const MqttCallback &callback) override
+    {
+        while (!inbound.empty())
+        {
+            CapturedMessage msg = inbound.front();
+            inbound.pop_front();
+            if (!callback)
+                continue;
+            // PubSubClient hands out its own mutable buffer
+            std::vector<char> topic(msg.topic.begin(), msg.topic.end());
+            topic.push_back('\0');
+            std::vector<uint8_t> payload(msg.payload.begin(), msg.payload.end());
+            payload.push_back('\0');
+            callback(topic.data(), payload.data(), (unsigned int)msg.payload.size());
+        }
+        return true;
+    }
+
+private:
+    bool isConnected = false;
+    std::deque<CapturedMessage> inbound;
+};
+
+#endif
@@ -0,0 +1,469 @@
+// Time-accelerated replay of recorded moisture traces and command logs
+// against the real valve/sensor logic (sensors.cpp, mqtt.cpp).
+//
+// Trace format, one event per line, time in seconds from trace start:
+//   <seconds> adc <raw>          ADC value held until the next adc event
+//   <seconds> cmd <json>         payload delivered on the commands topic
+//   <seconds> flow <l/min>       line flow while the valve is open (pressure changes)
+//   # comment
+//
+// Usage:
+//   program --trace <file> [--policy name:key=value,...]... [--step-ms N]
+//           [--wrap-in S] [--capture <prefix>] [--echo]
+// --wrap-in starts the clock S seconds before the 32-bit millis() wraps, so
+// the replay crosses the rollover the way a device does after 49.7 days.
+// Policy keys: duration (min), limit (moisture), read (min), publish (min),
+//              flow (initial l/min), ppl (sensor pulses/l), cal_min, cal_max
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "globals.h"
+#include "sensors.h"
+#include "mqtt.h"
+#include "flow_meter.h"
+#include "host_hal.h"
+#include "capture_transport.h"
+
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+
+namespace
+{
+    enum TraceKind
+    {
+        TraceAdc,
+        TraceCommand,
+        TraceFlow,
+    };
+
+    struct TraceEvent
+    {
+        uint64_t atMs;
+        TraceKind kind;
+        int raw;
+        double litersPerMinute;
+        std::string payload;
+    };
+
+    struct Policy
+    {
+        std::string name = "default";
+        unsigned int durationMinutes = 10;
+        unsigned int moistureLimit = 150;
+        unsigned long readMinutes = 5;
+        unsigned long publishMinutes = 10;
+        double litersPerMinute = 10.0;
+        double pulsesPerLiter = 450.0;
+        int calibrationMin = -1;
+        int calibrationMax = -1;
+    };
+
+    // Plain struct so it can cross the pipe from the forked replay
+    struct PolicyResult
+    {
+        char name[32];
+        uint64_t simulatedMs;
+        uint64_t valveOpenMs;
+        double litersUsed;
+        uint32_t valveCycles;
+        uint32_t watchdogTrips;
+        uint32_t timedStops;
+        uint32_t volumeStops;
+        uint32_t adcReads;
+        uint32_t commands;
+        uint32_t published;
+        uint32_t publishFailures;
+        uint32_t reboots;
+        double wallSeconds;
+    };
+
+    bool parseTrace(const char *path, std::vector<TraceEvent> &events)
+    {
+        std::ifstream in(path);
+        if (!in)
+            return false;
+
+        std::string line;
+        unsigned lineNo = 0;
+        while (std::getline(in, line))
+        {
+            lineNo++;
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::istringstream ls(line);
+            double seconds;
+            std::string kind;
+            if (!(ls >> seconds >> kind))
+            {
+                fprintf(stderr, "trace:%u: malformed line\n", lineNo);
+                continue;
+            }
+
+            TraceEvent ev = {(uint64_t)(seconds * 1000.0), TraceAdc, 0, 0.0, ""};
+            if (kind == "adc")
+            {
+                ls >> ev.raw;
+            }
+            else if (kind == "cmd")
+            {
+                ev.kind = TraceCommand;
+                std::getline(ls >> std::ws, ev.payload);
+            }
+            else if (kind == "flow")
+            {
+                ev.kind = TraceFlow;
+                ls >> ev.litersPerMinute;
+            }
+            else
+            {
+                fprintf(stderr, "trace:%u: unknown event '%s'\n", lineNo, kind.c_str());
+                continue;
+            }
+            events.push_back(ev);
+        }
+
+        std::stable_sort(events.begin(), events.end(),
+                         [](const TraceEvent &a, const TraceEvent &b) { return a.atMs < b.atMs; });
+        return true;
+    }
+
+    bool parsePolicy(const std::string &spec, Policy &policy)
+    {
+        size_t colon = spec.find(':');
+        policy.name = spec.substr(0, colon);
+        if (colon == std::string::npos)
+            return true;
+
+        std::istringstream kvs(spec.substr(colon + 1));
+        std::string kv;
+        while (std::getline(kvs, kv, ','))
+        {
+            size_t eq = kv.find('=');
+            if (eq == std::string::npos)
+                return false;
+            std::string key = kv.substr(0, eq);
+            double value = atof(kv.c_str() + eq + 1);
+
+            if (key == "duration")
+                policy.durationMinutes = (unsigned int)value;
+            else if (key == "limit")
+                policy.moistureLimit = (unsigned int)value;
+            else if (key == "read")
+                policy.readMinutes = (unsigned long)value;
+            else if (key == "publish")
+                policy.publishMinutes = (unsigned long)value;
+            else if (key == "flow")
+                policy.litersPerMinute = value;
+            else if (key == "ppl")
+                policy.pulsesPerLiter = value;
+            else if (key == "cal_min")
+                policy.calibrationMin = (int)value;
+            else if (key == "cal_max")
+                policy.calibrationMax = (int)value;
+            else
+                return false;
+        }
+        return true;
+    }
+
+    // Mirrors setup() in main.cpp minus WiFi, OTA and Alexa
+    void simulatedSetup(const Policy &policy)
+    {
+        deviceID = "SIM";
+        deviceIP = "127.0.0.1";
+        topics = {
+            "smartkler/commands/" + deviceID,
+            "smartkler/systemEvents/" + deviceID,
+            "smartkler/data/" + deviceID,
+            "smartkler/valve/" + deviceID,
+            "smartkler/lwt/" + deviceID,
+        };
+
+        defaultDurationMinutes = policy.durationMinutes;
+        defaultMoistureLimit = policy.moistureLimit;
+        soilReadsIntervalMs = policy.readMinutes * 60UL * 1000UL;
+        sensorInfoPublishIntervalMs = policy.publishMinutes * 60UL * 1000UL;
+        flowPulsesPerLiter = (float)policy.pulsesPerLiter;
+        if (policy.calibrationMin >= 0)
+            soilMoistureCalibrationMin = policy.calibrationMin;
+        if (policy.calibrationMax >= 0)
+            soilMoistureCalibrationMax = policy.calibrationMax;
+
+        pinMode(pinIgro, INPUT);
+        pinMode(pinRelay, OUTPUT);
+        digitalWrite(pinRelay, LOW);
+
+        connectToMQTT();
+        publishSensorData(true);
+        publishSystemEvent("Smartkler Started", "system_started");
+    }
+
+    // Virtual time at which the trace starts; millis() is its low 32 bits
+    uint64_t clockStartMs = 0;
+
+    PolicyResult replay(const Policy &policy, const std::vector<TraceEvent> &events,
+                        unsigned long stepMs, const char *capturePrefix)
+    {
+        PolicyResult result = {};
+        snprintf(result.name, sizeof(result.name), "%s", policy.name.c_str());
+
+        FILE *capture = nullptr;
+        if (capturePrefix)
+        {
+            std::string path = std::string(capturePrefix) + "." + policy.name + ".log";
+            capture = fopen(path.c_str(), "w");
+        }
+
+        int adcValue = 0;
+        double lineLitersPerMinute = policy.litersPerMinute;
+        double pendingPulses = 0.0;
+        uint64_t valveOpenedAt = 0;
+        bool valveOpen = false;
+
+        host::setTimeMs(clockStartMs);
+        host::resetPins();
+        host::setAnalogSource([&](uint8_t) {
+            result.adcReads++;
+            return adcValue;
+        });
+        host::setPinWriteHook([&](uint8_t pin, uint8_t val) {
+            if (pin != pinRelay || (bool)val == valveOpen)
+                return;
+            valveOpen = val;
+            if (valveOpen)
+            {
+                valveOpenedAt = host::nowMs();
+                result.valveCycles++;
+            }
+            else
+            {
+                result.valveOpenMs += host::nowMs() - valveOpenedAt;
+            }
+        });
+        host::setRestartHook([&]() {
+            result.reboots++;
+            digitalWrite(pinRelay, LOW);
+        });
+
+        CaptureTransport transport;
+        transport.sink = [&](const CapturedMessage &msg) {
+            result.published++;
+            if (capture)
+                fprintf(capture, "%lu %s %s\n", msg.atMs, msg.topic.c_str(), msg.payload.c_str());
+
+            if (msg.topic != topics.systemEvents.c_str())
+                return;
+
+            DynamicJsonDocument doc(1024);
+            if (deserializeJson(doc, msg.payload))
+                return;
+            // Failure reports are published raw, without the envelope
+            JsonVariantConst event = doc.containsKey("data") ? doc["data"] : doc.as<JsonVariantConst>();
+            const char *code = event["action_code"] | "";
+            if (strcmp(code, "Watchdog security Timeout") == 0)
+                result.watchdogTrips++;
+            else if (strcmp(code, "Regular time expired") == 0)
+                result.timedStops++;
+            else if (strcmp(code, "Volume target reached") == 0)
+                result.volumeStops++;
+            else if (strcmp(code, "mqtt_publish_failed") == 0 || strcmp(code, "mqtt_payload_overflow") == 0)
+                result.publishFailures++;
+        };
+        mqttClient.attach(&transport);
+
+        for (const TraceEvent &ev : events)
+        {
+            if (ev.kind == TraceAdc)
+            {
+                adcValue = ev.raw;
+                break;
+            }
+        }
+
+        auto wallStart = std::chrono::steady_clock::now();
+        simulatedSetup(policy);
+
+        uint64_t endMs = clockStartMs + (events.empty() ? 0 : events.back().atMs + valveSecurityStop);
+        size_t next = 0;
+
+        while (host::nowMs() <= endMs)
+        {
+            uint64_t now = host::nowMs();
+            for (; next < events.size() && clockStartMs + events[next].atMs <= now; next++)
+            {
+                switch (events[next].kind)
+                {
+                case TraceCommand:
+                    transport.inject(topics.commands.c_str(), events[next].payload);
+                    result.commands++;
+                    break;
+                case TraceFlow:
+                    lineLitersPerMinute = events[next].litersPerMinute;
+                    break;
+                case TraceAdc:
+                    adcValue = events[next].raw;
+                    break;
+                }
+            }
+
+            // Same order as loop() in main.cpp
+            mqttClient.loop();
+            mqttProcessQueue();
+            flowMeterLoop();
+            checkValveWatchdog();
+            processDeferredSensorPublish();
+            processPendingDataRequest();
+
+            if (millis() - lastSensorInfoPublished >= sensorInfoPublishIntervalMs)
+            {
+                lastSensorInfoPublished = millis();
+                publishSensorData();
+            }
+
+            host::advanceTime(stepMs);
+
+            // Water flows for the whole step the valve was left open
+            if (valveOpen)
+            {
+                double liters = lineLitersPerMinute * stepMs / 60000.0;
+                result.litersUsed += liters;
+                pendingPulses += liters * policy.pulsesPerLiter;
+                uint32_t whole = (uint32_t)pendingPulses;
+                host::addPulses(pinFlow, whole);
+                pendingPulses -= whole;
+            }
+        }
+
+        if (valveOpen)
+            result.valveOpenMs += host::nowMs() - valveOpenedAt;
+
+        result.simulatedMs = host::nowMs() - clockStartMs;
+        result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+        if (capture)
+            fclose(capture);
+        return result;
+    }
+
+    // Each policy replays in a fresh process so module statics start clean
+    bool replayIsolated(const Policy &policy, const std::vector<TraceEvent> &events,
+                        unsigned long stepMs, const char *capturePrefix, PolicyResult &result)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+            return false;
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0)
+            return false;
+
+        if (pid == 0)
+        {
+            close(fds[0]);
+            PolicyResult r = replay(policy, events, stepMs, capturePrefix);
+            ssize_t written = write(fds[1], &r, sizeof(r));
+            _exit(written == (ssize_t)sizeof(r) ? 0 : 1);
+        }
+
+        close(fds[1]);
+        ssize_t got = read(fds[0], &result, sizeof(result));
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return got == (ssize_t)sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    void printResult(const PolicyResult &r)
+    {
+        double days = r.simulatedMs / 86400000.0;
+        printf("%-16s %8.1f d %10.1f l %10.1f min %6u %6u %6u %6u %8u %8u %6u %8.2f s (%.0fx)\n",
+               r.name, days, r.litersUsed, r.valveOpenMs / 60000.0, r.valveCycles,
+               r.timedStops, r.volumeStops, r.watchdogTrips, r.commands, r.published, r.publishFailures,
+               r.wallSeconds, r.wallSeconds > 0 ? r.simulatedMs / 1000.0 / r.wallSeconds : 0.0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *tracePath = nullptr;
+    const char *capturePrefix = nullptr;
+    unsigned long stepMs = 1000;
+    std::vector<Policy> policies;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--trace" && hasValue)
+            tracePath = argv[++i];
+        else if (arg == "--step-ms" && hasValue)
+            stepMs = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--wrap-in" && hasValue)
+        {
+            uint64_t wrapInMs = strtoull(argv[++i], nullptr, 10) * 1000ULL;
+            clockStartMs = wrapInMs < (1ULL << 32) ? (1ULL << 32) - wrapInMs : 0;
+        }
+        else if (arg == "--capture" && hasValue)
+            capturePrefix = argv[++i];
+        else if (arg == "--echo")
+            host::setSerialEcho(true);
+        else if (arg == "--policy" && hasValue)
+        {
+            Policy policy;
+            if (!parsePolicy(argv[++i], policy))
+            {
+                fprintf(stderr, "Invalid policy: %s\n", argv[i]);
+                return 2;
+            }
+            policies.push_back(policy);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s --trace <file> [--policy name:key=value,...]... "
+                            "[--step-ms N] [--wrap-in S] [--capture <prefix>] [--echo]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<TraceEvent> events;
+    if (!tracePath || !parseTrace(tracePath, events))
+    {
+        fprintf(stderr, "Cannot read trace %s\n", tracePath ? tracePath : "(none)");
+        return 1;
+    }
+    if (policies.empty())
+        policies.push_back(Policy());
+    if (stepMs == 0)
+        stepMs = 1;
+
+    printf("%-16s %10s %12s %14s %6s %6s %6s %6s %8s %8s %6s %10s\n",
+           "policy", "simulated", "water", "valve open", "cycles", "timed", "volume", "wdog",
+           "commands", "mqtt", "fails", "wall");
+
+    int exitCode = 0;
+    for (const Policy &policy : policies)
+    {
+        PolicyResult result;
+        if (!replayIsolated(policy, events, stepMs, capturePrefix, result))
+        {
+            fprintf(stderr, "Replay failed for policy %s\n", policy.name.c_str());
+            exitCode = 1;
+            continue;
+        }
+        printResult(result);
+    }
+
+    return exitCode;
+}
@@ -0,0 +1,63 @@
+#ifndef COMMAND_ADMISSION_H
+#define COMMAND_ADMISSION_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Admission control for MQTT commands: a token bucket per command class,
+// debouncing of repeated setValve and coalescing of getData requests, so a
+// client polling in a tight loop cannot starve loop() and the valve watchdog.
+
+enum CommandClass : uint8_t
+{
+  COMMAND_CLASS_QUERY,  // getData, ping
+  COMMAND_CLASS_VALVE,  // setValve; "off" is never rate limited
+  COMMAND_CLASS_CONFIG, // setConfigParam
+  COMMAND_CLASS_SYSTEM, // reboot, shutdown, OTA
+  COMMAND_CLASS_NODE,   // setNodeValve (gateway)
+  COMMAND_CLASS_COUNT
+};
+
+enum AdmissionResult
+{
+  ADMISSION_ACCEPTED,
+  ADMISSION_RATE_LIMITED,
+  ADMISSION_DEBOUNCED
+};
+
+// Counts spent tokens, so a zero-initialised bucket starts full
+struct TokenBucket
+{
+  uint8_t spent;
+  uint32_t lastRefill;
+};
+
+// One struct, so a host harness can swap it per virtual device
+struct CommandAdmissionState
+{
+  TokenBucket buckets[COMMAND_CLASS_COUNT];
+  bool valveCommandSeen;
+  bool lastValveOn;
+  uint32_t lastValveCommandTime;
+  bool dataRequestPending;
+  bool dataRequestForce;
+  uint32_t lastDataRequestServed;
+  bool rejectionReported;
+  uint32_t lastRejectionReport;
+  unsigned long rejectionsSuppressed;
+};
+
+extern CommandAdmissionState commandAdmission;
+
+AdmissionResult commandAdmit(CommandClass commandClass, const JsonDocument &doc);
+const char *admissionResultName(AdmissionResult result);
+
+// getData: returns false if the request was merged into one already pending
+bool commandAdmissionQueueDataRequest(bool force);
+bool commandAdmissionTakeDataRequest(bool &force);
+
+// At most one rejection event per window; suppressed is how many were
+// rejected silently since the last one reported
+bool commandAdmissionReportRejection(unsigned long &suppressed);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef FLOW_METER_H
+#define FLOW_METER_H
+
+#include <Arduino.h>
+
+// Pulse-output flow sensor on pinFlow. Pulses are counted by the PCNT unit
+// on ESP32 and by an edge interrupt on ESP8266, never polled from loop().
+
+void flowMeterSetup();
+void flowMeterLoop();
+uint32_t flowMeterPulses();
+float flowMeterLitersPerMinute();
+float flowMeterTotalLiters();
+
+// Volume delivered since the valve was last opened
+void flowMeterMarkValveOpen();
+float flowMeterDeliveredLiters();
+
+#endif
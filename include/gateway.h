@@ -0,0 +1,36 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include <Arduino.h>
+#include "node_link.h"
+
+// Gateway role (-DSMARTKLER_GATEWAY): readings from sensor nodes are batched
+// into one publish on topics.data, and valve commands for a node are held
+// until the node wakes and acknowledges them.
+
+struct GatewayStats
+{
+  unsigned long readings;
+  unsigned long readingsReplaced; // newer reading from the same node in one batch
+  unsigned long duplicates;
+  unsigned long malformed;
+  unsigned long tableFull;
+  unsigned long nodesEvicted; // slot of a stale node reused for a new one
+  unsigned long batches;
+  unsigned long commandsSent;
+  unsigned long commandsAcked;
+  unsigned long commandsExpired;
+  unsigned long commandsSuperseded;
+  unsigned long sendFailures;
+};
+
+void gatewaySetup(NodeLink &link);
+void gatewayLoop();
+
+// nodeId is the node MAC as 12 upper-case hex digits
+bool gatewayQueueValveCommand(const char *nodeId, bool open, uint16_t minutes);
+
+size_t gatewayNodeCount();
+const GatewayStats &gatewayStats();
+
+#endif
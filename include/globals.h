@@ -18,25 +18,33 @@ extern String deviceID;
 extern String deviceIP;
 extern const int pinIgro;
 extern const int pinRelay;
+extern const int pinFlow;
 
 // Soil moisture sensor
 extern int soilMoistureCalibrationMin;
 extern int soilMoistureCalibrationMax;
-extern unsigned long lastMoistureReadTime;
-extern StaticJsonDocument<128> lastMoistureData;
+extern uint32_t lastMoistureReadTime;
+// Sized in slots, not bytes: a slot is twice as large on 64-bit host builds
+typedef StaticJsonDocument<JSON_OBJECT_SIZE(5)> SoilReadingDoc; // raw, percent, timestamp, raw_mapper_min/max
+typedef StaticJsonDocument<JSON_OBJECT_SIZE(1)> RelayStateDoc;   // relay_state
+extern SoilReadingDoc lastMoistureData;
 extern unsigned long soilReadsIntervalMs;
 
 // Relay
-extern unsigned long lastValveStartTime;
+extern uint32_t lastValveStartTime;
 extern const unsigned long valveSecurityStop;
 extern unsigned long valveDurationMs;
+extern float valveTargetLiters;
+
+// Flow sensor
+extern float flowPulsesPerLiter;
 
 // Utils
 String getUptime();
 extern unsigned long GetEpochTime();
 extern unsigned int defaultDurationMinutes;
 extern unsigned int defaultMoistureLimit;
-extern unsigned long lastSensorInfoPublished;
+extern uint32_t lastSensorInfoPublished;
 extern unsigned long sensorInfoPublishIntervalMs;
 String getDeviceId();
 
@@ -0,0 +1,10 @@
+#ifndef HTTP_API_H
+#define HTTP_API_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+void httpApiSetup(AsyncWebServer &server);
+void httpApiLoop();
+
+#endif
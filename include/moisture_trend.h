@@ -0,0 +1,37 @@
+#ifndef MOISTURE_TREND_H
+#define MOISTURE_TREND_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Rolling statistics over the soil moisture history. Samples are stored as
+// centi-percent (0..10000) in a fixed ring; each window keeps running sums
+// and monotonic min/max queues so adding a sample is O(1).
+
+const uint16_t trendHistoryCapacity = 128;
+const uint8_t trendWindowCount = 2; // 0 = short, 1 = long (used for the prediction)
+// Windows hold at most trendHistoryCapacity - 1 samples: the evicted one must still be in the ring
+
+struct TrendStats
+{
+    uint16_t count;
+    int16_t min;          // centi-percent
+    int16_t max;          // centi-percent
+    float mean;           // percent
+    float stddev;         // percent
+    float slopePerHour;   // percent per hour, 0 with fewer than 2 samples
+};
+
+// moistureTrendToJson output: short, long, limit, minutes_to_limit and 6 stats per window
+const size_t moistureTrendJsonCapacity = JSON_OBJECT_SIZE(4) + trendWindowCount * JSON_OBJECT_SIZE(6);
+
+// Returns false, keeping nothing, for a sample less than soilReadsIntervalMs
+// after the last one kept
+bool moistureTrendAddSample(int raw, uint32_t nowMs);
+bool moistureTrendGetStats(uint8_t window, TrendStats &stats);
+bool moistureTrendSetWindowSize(uint8_t window, uint16_t samples);
+uint16_t moistureTrendWindowSize(uint8_t window);
+long moistureTrendMinutesToLimit(unsigned int limitPercent);
+void moistureTrendToJson(JsonObject out);
+
+#endif
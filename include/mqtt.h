@@ -3,15 +3,35 @@
 
 #include <Arduino.h>
 #include <PubSubClient.h>
+#include "mqtt_queue.h"
 
 extern PubSubClient mqttClient;
 
+struct CommandStats
+{
+  unsigned long accepted;
+  unsigned long parseErrors;
+  unsigned long tooLarge;
+  unsigned long missingCommand;
+  unsigned long unknownCommand;
+  unsigned long rateLimited;
+  unsigned long debounced;
+  unsigned long coalesced;
+};
+
+extern CommandStats commandStats;
+
 void connectToMQTT();
 void checkMQTTConnection();
 void mqttSubscribe(const char* topic);
 void mqttPublish(const char *topic, const JsonDocument &payload);
+void mqttPublish(const char *topic, const JsonDocument &payload, MqttPriority priority);
+void mqttProcessQueue();
+void mqttFlushQueue(unsigned long timeoutMs);
 void mqttCallback(char *topic, byte *payload, unsigned int length);
+bool runCommand(const String &command, const JsonDocument &doc);
 void publishSensorData(bool calibrate = false);
-void publishSystemEvent(const char *action, const char *actionCode);
+void processPendingDataRequest();
+void publishSystemEvent(const char *action, const char *actionCode, MqttPriority priority = MQTT_PRIORITY_SYSTEM);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef MQTT_QUEUE_H
+#define MQTT_QUEUE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Outbound MQTT messages are queued here and sent from loop(), so actuation
+// paths (relay, watchdog, fauxmo, HTTP) never wait on the broker socket.
+
+enum MqttPriority : uint8_t
+{
+  MQTT_PRIORITY_TELEMETRY = 0, // sensor snapshots, coalesced per topic
+  MQTT_PRIORITY_SYSTEM = 1,    // events and command responses
+  MQTT_PRIORITY_SAFETY = 2     // valve state and forced shut-offs
+};
+
+enum MqttSendResult
+{
+  MQTT_SEND_OK,
+  MQTT_SEND_RETRY, // keep the message, stop draining for this iteration
+  MQTT_SEND_DROP
+};
+
+struct MqttQueueStats
+{
+  unsigned long enqueued;
+  unsigned long sent;
+  unsigned long dropped;
+  unsigned long coalesced;
+  unsigned long retries;
+  size_t highWater;
+};
+
+const size_t mqttQueueCapacity = 16;
+
+struct MqttQueuedMessage
+{
+  char *block; // "topic\0payload\0", nullptr when the slot is free
+  uint16_t topicLength;
+  uint16_t payloadLength;
+  MqttPriority priority;
+  bool sending;
+  uint32_t enqueuedAt;
+  uint32_t seq;
+};
+
+// One struct, so a host harness can swap it per virtual device
+struct MqttQueueState
+{
+  MqttQueuedMessage slots[mqttQueueCapacity];
+  size_t count;
+  size_t bytes;
+  uint32_t nextSeq;
+};
+
+extern MqttQueueState mqttQueue;
+
+// Sends one message; ageMs is the time it spent in the queue
+typedef MqttSendResult (*MqttQueueSender)(const char *topic, const char *payload, size_t length, unsigned long ageMs);
+
+bool mqttQueuePush(const char *topic, const JsonDocument &payload, MqttPriority priority);
+size_t mqttQueueProcess(MqttQueueSender sender, unsigned long budgetMs);
+void mqttQueueClear();
+size_t mqttQueueDepth();
+size_t mqttQueueBytes();
+const MqttQueueStats &mqttQueueStats();
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef MQTT_TLS_H
+#define MQTT_TLS_H
+
+#include <Arduino.h>
+
+// Network client under PubSubClient: plain TCP by default, TLS when built
+// with -DMQTT_USE_TLS. On ESP8266 the TLS session is cached across
+// reconnects and, through RTC memory, across reboots.
+
+#if defined(MQTT_USE_TLS)
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <WiFiClientSecureBearSSL.h>
+typedef BearSSL::WiFiClientSecure MqttNetClient;
+#elif defined(ESP32)
+#include <WiFiClientSecure.h>
+typedef WiFiClientSecure MqttNetClient;
+#endif
+
+void mqttTlsSetup(const char *host, uint16_t port, const char *caCert, const char *fingerprint);
+bool mqttTlsBeforeConnect(); // false: do not connect now (clock not set, or no usable trust anchor)
+bool mqttTlsAfterConnect(bool connected);
+#else
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif
+typedef WiFiClient MqttNetClient;
+
+inline void mqttTlsSetup(const char *, uint16_t, const char *, const char *) {}
+inline bool mqttTlsBeforeConnect() { return true; }
+inline bool mqttTlsAfterConnect(bool) { return false; }
+#endif
+
+extern MqttNetClient espClient;
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef NODE_LINK_H
+#define NODE_LINK_H
+
+#include <Arduino.h>
+
+// Radio link between the gateway and battery sensor nodes. Frames are small
+// packed structs; a node sends a reading on every wake and listens briefly
+// for a command frame in reply before going back to sleep.
+
+const uint8_t nodeProtocolVersion = 1;
+const size_t nodeMaxFrameBytes = 32;
+
+enum NodeFrameType : uint8_t
+{
+  NODE_FRAME_READING = 1, // node -> gateway
+  NODE_FRAME_COMMAND = 2  // gateway -> node
+};
+
+struct __attribute__((packed)) NodeReadingFrame
+{
+  uint8_t type;
+  uint8_t version;
+  uint16_t seq;         // per wake, repeats on link-level retries
+  uint16_t moistureRaw; // ADC reading, calibrated on the gateway
+  uint16_t batteryMv;
+  uint8_t valveOpen;
+  uint8_t commandSeq; // last command applied, 0 if none
+};
+
+struct __attribute__((packed)) NodeCommandFrame
+{
+  uint8_t type;
+  uint8_t version;
+  uint8_t commandSeq;
+  uint8_t valveOpen;
+  uint16_t minutes;
+};
+
+struct NodeAddress
+{
+  uint8_t mac[6];
+};
+
+struct NodePacket
+{
+  NodeAddress from;
+  int8_t rssi; // 0 when the radio does not report it
+  uint8_t length;
+  uint8_t data[nodeMaxFrameBytes];
+};
+
+class NodeLink
+{
+public:
+  virtual ~NodeLink() {}
+  virtual bool begin() = 0;
+  virtual bool send(const NodeAddress &to, const uint8_t *data, size_t length) = 0;
+  // Non-blocking: false when nothing is waiting
+  virtual bool receive(NodePacket &packet) = 0;
+  // Releases whatever the link keeps per node, for a node that gave up its slot
+  virtual void forget(const NodeAddress &address) = 0;
+};
+
+#if defined(ESP8266) || defined(ESP32)
+// ESP-NOW on the channel of the WiFi station. Received frames are buffered
+// from the WiFi task and handed to loop() by receive().
+class EspNowLink : public NodeLink
+{
+public:
+  bool begin() override;
+  bool send(const NodeAddress &to, const uint8_t *data, size_t length) override;
+  bool receive(NodePacket &packet) override;
+  void forget(const NodeAddress &address) override;
+};
+#endif
+
+#endif
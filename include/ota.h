@@ -0,0 +1,11 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include <Arduino.h>
+
+void OTASetup();
+void otaLoop();
+// md5: 32 hex digits, MD5 of the file at url as served (the .gz for gzip images)
+void scheduleOtaPull(const String &url, const String &md5, unsigned long jitterSeconds);
+
+#endif
@@ -7,4 +7,9 @@ const uint16_t MQTT_PORT = 1883;
 const char *MQTT_USERNAME = "your_username";
 const char *MQTT_PASSWORD = "your_password";
 
+// TLS, used when built with -DMQTT_USE_TLS
+const uint16_t MQTT_TLS_PORT = 8883;
+const char *MQTT_CA_CERT = nullptr;     // PEM CA certificate that signed the broker certificate
+const char *MQTT_FINGERPRINT = nullptr; // or the broker certificate SHA-1 fingerprint (ESP8266 only)
+
 #endif
\ No newline at end of file
@@ -3,11 +3,15 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include "globals.h"
 
-StaticJsonDocument<128>& readSoilMoisture (bool forceRead);
-StaticJsonDocument<64>& readRelayState();
+SoilReadingDoc& readSoilMoisture (bool forceRead);
+RelayStateDoc& readRelayState();
 int setRelayState(bool state);
 void checkValveWatchdog();
 void processDeferredSensorPublish();
 
+// A fresh publish is already scheduled after a relay change
+extern bool sensorPublishPending;
+
 #endif
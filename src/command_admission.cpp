@@ -0,0 +1,142 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "command_admission.h"
+#include "globals.h"
+
+struct BucketLimit
+{
+  uint8_t burst;
+  unsigned long refillMs; // one token back every refillMs
+};
+
+// Indexed by CommandClass
+static const BucketLimit bucketLimits[COMMAND_CLASS_COUNT] = {
+    {10, 200},   // query: 5/s sustained
+    {5, 2000},   // valve
+    {3, 5000},   // config
+    {2, 60000},  // system
+    {8, 1000},   // node
+};
+
+// The same setValve state repeated within this window is dropped
+const unsigned long valveDebounceMs = 3000;
+// getData requests arriving faster than this are served by one publish
+const unsigned long dataRequestMinIntervalMs = 1000;
+// A flood of rejected commands produces one command_rejected event per window
+const unsigned long rejectionReportIntervalMs = 10000;
+
+CommandAdmissionState commandAdmission = {};
+
+static bool takeToken(CommandClass commandClass, uint32_t now)
+{
+  TokenBucket &bucket = commandAdmission.buckets[commandClass];
+  const BucketLimit &limit = bucketLimits[commandClass];
+
+  unsigned long refilled = (now - bucket.lastRefill) / limit.refillMs;
+  if (refilled >= bucket.spent)
+  {
+    bucket.spent = 0;
+    bucket.lastRefill = now;
+  }
+  else
+  {
+    bucket.spent -= refilled;
+    bucket.lastRefill += refilled * limit.refillMs;
+  }
+
+  if (bucket.spent >= limit.burst)
+    return false;
+
+  bucket.spent++;
+  return true;
+}
+
+static AdmissionResult admitValve(const JsonDocument &doc, uint32_t now)
+{
+  String state = doc["state"] | "";
+  state.toLowerCase();
+  bool on = state == "on";
+
+  // Same state as the last accepted command, and the relay already there
+  bool relayOn = digitalRead(pinRelay) == HIGH;
+  if (commandAdmission.valveCommandSeen && commandAdmission.lastValveOn == on && relayOn == on &&
+      now - commandAdmission.lastValveCommandTime < valveDebounceMs)
+    return ADMISSION_DEBOUNCED;
+
+  // Closing the valve must always get through
+  if (on && !takeToken(COMMAND_CLASS_VALVE, now))
+    return ADMISSION_RATE_LIMITED;
+
+  if (on || state == "off")
+  {
+    commandAdmission.valveCommandSeen = true;
+    commandAdmission.lastValveOn = on;
+    commandAdmission.lastValveCommandTime = now;
+  }
+  return ADMISSION_ACCEPTED;
+}
+
+AdmissionResult commandAdmit(CommandClass commandClass, const JsonDocument &doc)
+{
+  uint32_t now = millis();
+
+  if (commandClass == COMMAND_CLASS_VALVE)
+    return admitValve(doc, now);
+
+  return takeToken(commandClass, now) ? ADMISSION_ACCEPTED : ADMISSION_RATE_LIMITED;
+}
+
+const char *admissionResultName(AdmissionResult result)
+{
+  switch (result)
+  {
+  case ADMISSION_RATE_LIMITED:
+    return "rate limited";
+  case ADMISSION_DEBOUNCED:
+    return "debounced";
+  default:
+    return "accepted";
+  }
+}
+
+bool commandAdmissionQueueDataRequest(bool force)
+{
+  bool merged = commandAdmission.dataRequestPending;
+
+  commandAdmission.dataRequestPending = true;
+  commandAdmission.dataRequestForce |= force;
+  return !merged;
+}
+
+bool commandAdmissionTakeDataRequest(bool &force)
+{
+  if (!commandAdmission.dataRequestPending)
+    return false;
+
+  uint32_t now = millis();
+  if (commandAdmission.lastDataRequestServed != 0 &&
+      now - commandAdmission.lastDataRequestServed < dataRequestMinIntervalMs)
+    return false;
+
+  force = commandAdmission.dataRequestForce;
+  commandAdmission.dataRequestPending = false;
+  commandAdmission.dataRequestForce = false;
+  commandAdmission.lastDataRequestServed = now;
+  return true;
+}
+
+bool commandAdmissionReportRejection(unsigned long &suppressed)
+{
+  uint32_t now = millis();
+  if (commandAdmission.rejectionReported && now - commandAdmission.lastRejectionReport < rejectionReportIntervalMs)
+  {
+    commandAdmission.rejectionsSuppressed++;
+    return false;
+  }
+
+  suppressed = commandAdmission.rejectionsSuppressed;
+  commandAdmission.rejectionsSuppressed = 0;
+  commandAdmission.rejectionReported = true;
+  commandAdmission.lastRejectionReport = now;
+  return true;
+}
@@ -0,0 +1,150 @@
+#include <Arduino.h>
+#if defined(ESP32)
+#include <driver/pcnt.h>
+#elif defined(SMARTKLER_HOST)
+#include "host_hal.h"
+#endif
+#include "flow_meter.h"
+#include "globals.h"
+
+const unsigned long flowRateSampleIntervalMs = 1000;
+
+static uint32_t valveOpenPulses = 0;
+static uint32_t lastRatePulses = 0;
+static uint32_t lastRateSampleTime = 0;
+static float currentLitersPerMinute = 0.0f;
+
+// The first rate interval starts here, not at millis() zero
+static void flowMeterStartRate()
+{
+    lastRatePulses = flowMeterPulses();
+    lastRateSampleTime = millis();
+}
+
+#if defined(ESP32)
+// The hardware counter is 16 bit: it wraps at flowPcntLimit and the ISR
+// only runs on wrap, once every flowPcntLimit pulses.
+const pcnt_unit_t flowPcntUnit = PCNT_UNIT_0;
+const int16_t flowPcntLimit = 10000;
+static volatile uint32_t flowPcntWraps = 0;
+
+static void IRAM_ATTR flowPcntWrapIsr(void *)
+{
+    uint32_t status = 0;
+    pcnt_get_event_status(flowPcntUnit, &status);
+    if (status & PCNT_EVT_H_LIM)
+        flowPcntWraps++;
+}
+
+void flowMeterSetup()
+{
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = pinFlow;
+    config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    config.channel = PCNT_CHANNEL_0;
+    config.unit = flowPcntUnit;
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DIS;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.counter_h_lim = flowPcntLimit;
+    config.counter_l_lim = 0;
+    pcnt_unit_config(&config);
+
+    pcnt_set_filter_value(flowPcntUnit, 1000); // ~12 us glitch filter at 80 MHz APB
+    pcnt_filter_enable(flowPcntUnit);
+
+    pcnt_event_enable(flowPcntUnit, PCNT_EVT_H_LIM);
+    pcnt_counter_pause(flowPcntUnit);
+    pcnt_counter_clear(flowPcntUnit);
+    pcnt_isr_service_install(0);
+    pcnt_isr_handler_add(flowPcntUnit, flowPcntWrapIsr, nullptr);
+    pcnt_counter_resume(flowPcntUnit);
+    flowMeterStartRate();
+}
+
+uint32_t flowMeterPulses()
+{
+    uint32_t wraps;
+    int16_t count;
+
+    // Re-read if the counter wrapped between the two reads
+    do
+    {
+        wraps = flowPcntWraps;
+        pcnt_get_counter_value(flowPcntUnit, &count);
+    } while (wraps != flowPcntWraps);
+
+    // A wrap whose ISR has not run yet reads as a step back: hold the last value
+    static uint32_t lastPulses = 0;
+    uint32_t pulses = wraps * (uint32_t)flowPcntLimit + (uint32_t)count;
+    if ((int32_t)(pulses - lastPulses) > 0)
+        lastPulses = pulses;
+
+    return lastPulses;
+}
+#elif defined(ESP8266)
+static volatile uint32_t flowPulseCount = 0;
+
+static void IRAM_ATTR flowPulseIsr()
+{
+    flowPulseCount++;
+}
+
+void flowMeterSetup()
+{
+    pinMode(pinFlow, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(pinFlow), flowPulseIsr, FALLING);
+    flowMeterStartRate();
+}
+
+uint32_t flowMeterPulses()
+{
+    return flowPulseCount;
+}
+#else
+// Host builds: pulses are injected through host::addPulses()
+void flowMeterSetup()
+{
+    flowMeterStartRate();
+}
+
+uint32_t flowMeterPulses()
+{
+    return host::pulseCount(pinFlow);
+}
+#endif
+
+void flowMeterLoop()
+{
+    uint32_t now = millis();
+    unsigned long elapsed = now - lastRateSampleTime;
+
+    if (elapsed < flowRateSampleIntervalMs)
+        return;
+
+    uint32_t pulses = flowMeterPulses();
+    currentLitersPerMinute = (pulses - lastRatePulses) / flowPulsesPerLiter * 60000.0f / elapsed;
+    lastRatePulses = pulses;
+    lastRateSampleTime = now;
+}
+
+float flowMeterLitersPerMinute()
+{
+    return currentLitersPerMinute;
+}
+
+float flowMeterTotalLiters()
+{
+    return flowMeterPulses() / flowPulsesPerLiter;
+}
+
+void flowMeterMarkValveOpen()
+{
+    valveOpenPulses = flowMeterPulses();
+}
+
+float flowMeterDeliveredLiters()
+{
+    return (flowMeterPulses() - valveOpenPulses) / flowPulsesPerLiter;
+}
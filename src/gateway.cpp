@@ -0,0 +1,325 @@
+#if defined(SMARTKLER_GATEWAY)
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <strings.h>
+#include "gateway.h"
+#include "globals.h"
+#include "mqtt.h"
+
+const size_t gatewayMaxNodes = 16;               // ESP-NOW allows 20 unencrypted peers
+const size_t gatewayBatchMaxNodes = 5;           // keeps a batch within MQTT_MAX_PACKET_SIZE
+const unsigned long gatewayBatchWindowMs = 10000; // oldest reading waits at most this long
+const unsigned long gatewayCommandTimeoutMs = 60UL * 60UL * 1000UL;
+// A full table reuses the slot of a node silent this long; longer than the
+// command timeout, so an evicted node never has a command pending
+const unsigned long gatewayNodeStaleMs = 6UL * 60UL * 60UL * 1000UL;
+// Link-level retries arrive within this; the same seq later is a new reading
+// (a node that rebooted and started counting again)
+const unsigned long gatewayDuplicateWindowMs = 5000;
+const unsigned int gatewayMaxPacketsPerLoop = 8;
+
+struct GatewayNode
+{
+    NodeAddress address;
+    char id[13];
+
+    bool seqValid;
+    uint16_t lastSeq;
+    uint16_t moistureRaw;
+    uint16_t batteryMv;
+    bool valveOpen;
+    int8_t rssi;
+    uint32_t lastSeen;
+    bool batched; // latest reading not published yet
+
+    // Valve command waiting for the node to wake and acknowledge it
+    bool commandPending;
+    uint8_t commandSeq;
+    bool commandValveOpen;
+    uint16_t commandMinutes;
+    uint32_t commandQueuedAt;
+};
+
+static GatewayNode nodes[gatewayMaxNodes];
+static size_t nodeCount = 0;
+static NodeLink *nodeLink = nullptr;
+static size_t batchCount = 0;
+static uint32_t batchOpenedAt = 0;
+static GatewayStats stats = {};
+
+static GatewayNode *findNode(const NodeAddress &address)
+{
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        if (memcmp(nodes[i].address.mac, address.mac, sizeof(address.mac)) == 0)
+            return &nodes[i];
+    }
+    return nullptr;
+}
+
+static GatewayNode *findNode(const char *id)
+{
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        if (strcasecmp(nodes[i].id, id) == 0)
+            return &nodes[i];
+    }
+    return nullptr;
+}
+
+// Least recently seen node, if it has been silent long enough to give up its slot
+static GatewayNode *findStaleNode(uint32_t now)
+{
+    GatewayNode *oldest = nullptr;
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        GatewayNode &node = nodes[i];
+        if (node.commandPending || node.batched)
+            continue;
+        if (!oldest || now - node.lastSeen > now - oldest->lastSeen)
+            oldest = &node;
+    }
+
+    if (oldest && now - oldest->lastSeen >= gatewayNodeStaleMs)
+        return oldest;
+    return nullptr;
+}
+
+static GatewayNode *addNode(const NodeAddress &address, uint32_t now)
+{
+    GatewayNode *slot = nullptr;
+    if (nodeCount < gatewayMaxNodes)
+    {
+        slot = &nodes[nodeCount++];
+    }
+    else
+    {
+        slot = findStaleNode(now);
+        if (!slot)
+            return nullptr;
+        Serial.printf("[GATEWAY] Node %s silent for %lu s, slot reused\n", slot->id, (now - slot->lastSeen) / 1000UL);
+        nodeLink->forget(slot->address);
+        stats.nodesEvicted++;
+    }
+
+    GatewayNode &node = *slot;
+    node = {};
+    node.address = address;
+    snprintf(node.id, sizeof(node.id), "%02X%02X%02X%02X%02X%02X", address.mac[0], address.mac[1],
+             address.mac[2], address.mac[3], address.mac[4], address.mac[5]);
+
+    Serial.printf("[GATEWAY] New node %s (%u/%u)\n", node.id, (unsigned int)nodeCount, (unsigned int)gatewayMaxNodes);
+    return &node;
+}
+
+static void sendCommand(GatewayNode &node)
+{
+    NodeCommandFrame frame = {NODE_FRAME_COMMAND, nodeProtocolVersion, node.commandSeq,
+                              (uint8_t)node.commandValveOpen, node.commandMinutes};
+
+    if (nodeLink->send(node.address, (const uint8_t *)&frame, sizeof(frame)))
+        stats.commandsSent++;
+    else
+        stats.sendFailures++;
+}
+
+static void publishNodeValve(const GatewayNode &node, const char *result, unsigned long latencyMs)
+{
+    StaticJsonDocument<160> msg;
+    msg["command_result"] = result;
+    msg["node"] = node.id;
+    msg["valve"] = node.valveOpen;
+    msg["latency_ms"] = latencyMs;
+    mqttPublish(topics.valve.c_str(), msg);
+}
+
+static void flushBatch()
+{
+    if (batchCount == 0)
+        return;
+
+    uint32_t now = millis();
+    StaticJsonDocument<JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(gatewayBatchMaxNodes) +
+                       gatewayBatchMaxNodes * JSON_OBJECT_SIZE(7)> doc;
+    JsonArray list = doc.createNestedArray("nodes");
+
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        GatewayNode &node = nodes[i];
+        if (!node.batched)
+            continue;
+
+        int percent = map(node.moistureRaw, soilMoistureCalibrationMax, soilMoistureCalibrationMin, 0, 100);
+
+        JsonObject entry = list.createNestedObject();
+        entry["node"] = (const char *)node.id; // stored by pointer, not copied into doc
+        entry["igro"] = constrain(percent, 0, 100);
+        entry["raw"] = node.moistureRaw;
+        entry["battery_mv"] = node.batteryMv;
+        entry["valve"] = node.valveOpen;
+        if (node.rssi != 0)
+            entry["rssi"] = node.rssi;
+        entry["age_s"] = (now - node.lastSeen) / 1000UL;
+        node.batched = false;
+    }
+
+    // Not telemetry priority: the queue would let a later batch replace this one.
+    // An overflowed doc is refused there and reported as mqtt_payload_overflow.
+    mqttPublish(topics.data.c_str(), doc, MQTT_PRIORITY_SYSTEM);
+    stats.batches++;
+    batchCount = 0;
+}
+
+static void handlePacket(const NodePacket &packet)
+{
+    NodeReadingFrame frame;
+    if (packet.length != sizeof(frame) || packet.data[0] != NODE_FRAME_READING ||
+        packet.data[1] != nodeProtocolVersion)
+    {
+        stats.malformed++;
+        return;
+    }
+    memcpy(&frame, packet.data, sizeof(frame));
+
+    uint32_t now = millis();
+    GatewayNode *node = findNode(packet.from);
+    if (!node)
+        node = addNode(packet.from, now);
+    if (!node)
+    {
+        stats.tableFull++;
+        return;
+    }
+
+    // Link-level retries deliver the same reading more than once, within moments
+    bool duplicate = node->seqValid && frame.seq == node->lastSeq && now - node->lastSeen < gatewayDuplicateWindowMs;
+    node->lastSeen = now;
+    node->rssi = packet.rssi;
+
+    if (duplicate)
+    {
+        stats.duplicates++;
+    }
+    else
+    {
+        stats.readings++;
+        node->seqValid = true;
+        node->lastSeq = frame.seq;
+        node->moistureRaw = frame.moistureRaw;
+        node->batteryMv = frame.batteryMv;
+        node->valveOpen = frame.valveOpen;
+
+        if (node->batched)
+        {
+            stats.readingsReplaced++;
+        }
+        else
+        {
+            node->batched = true;
+            if (batchCount++ == 0)
+                batchOpenedAt = now;
+        }
+    }
+
+    // The node listens right after sending, so reply while it is awake
+    if (node->commandPending)
+    {
+        if (frame.commandSeq == node->commandSeq)
+        {
+            node->commandPending = false;
+            stats.commandsAcked++;
+            publishNodeValve(*node, node->valveOpen ? "node_valve_on" : "node_valve_off", now - node->commandQueuedAt);
+        }
+        else
+        {
+            sendCommand(*node);
+        }
+    }
+
+    if (batchCount >= gatewayBatchMaxNodes)
+        flushBatch();
+}
+
+void gatewaySetup(NodeLink &link)
+{
+    nodeLink = &link;
+    nodeCount = 0;
+    batchCount = 0;
+    stats = {};
+
+    if (!nodeLink->begin())
+    {
+        Serial.println("[GATEWAY] Node link init failed");
+        publishSystemEvent("Gateway node link init failed", "gateway_link_failed");
+        nodeLink = nullptr;
+        return;
+    }
+
+    Serial.println("[GATEWAY] Listening for sensor nodes");
+}
+
+void gatewayLoop()
+{
+    if (!nodeLink)
+        return;
+
+    NodePacket packet;
+    for (unsigned int i = 0; i < gatewayMaxPacketsPerLoop && nodeLink->receive(packet); i++)
+    {
+        handlePacket(packet);
+    }
+
+    uint32_t now = millis();
+    if (batchCount > 0 && now - batchOpenedAt >= gatewayBatchWindowMs)
+        flushBatch();
+
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        GatewayNode &node = nodes[i];
+        if (node.commandPending && now - node.commandQueuedAt >= gatewayCommandTimeoutMs)
+        {
+            node.commandPending = false;
+            stats.commandsExpired++;
+            publishNodeValve(node, "node_command_expired", now - node.commandQueuedAt);
+        }
+    }
+}
+
+bool gatewayQueueValveCommand(const char *nodeId, bool open, uint16_t minutes)
+{
+    GatewayNode *node = nodeLink ? findNode(nodeId) : nullptr;
+    if (!node)
+        return false;
+
+    if (node->commandPending)
+    {
+        stats.commandsSuperseded++;
+        publishNodeValve(*node, "node_command_superseded", millis() - node->commandQueuedAt);
+    }
+
+    // 0 means "no command applied" on the node side
+    node->commandSeq = node->commandSeq == 255 ? 1 : node->commandSeq + 1;
+    node->commandPending = true;
+    node->commandValveOpen = open;
+    node->commandMinutes = open ? minutes : 0;
+    node->commandQueuedAt = millis();
+
+    Serial.printf("[GATEWAY] Valve %s for node %s queued (seq %u)\n", open ? "ON" : "OFF", node->id, node->commandSeq);
+
+    // Mains-powered nodes, or one still in its listen window, get it right away
+    sendCommand(*node);
+    return true;
+}
+
+size_t gatewayNodeCount()
+{
+    return nodeCount;
+}
+
+const GatewayStats &gatewayStats()
+{
+    return stats;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "globals.h"
+
+// Global defines
+String deviceID;
+String deviceIP;
+Topics topics;
+
+#ifndef PIN_IGRO
+#if defined(ESP8266)
+#define PIN_IGRO A0
+#elif defined(ESP32)
+#define PIN_IGRO 34
+#else
+#define PIN_IGRO 0
+#endif
+#endif
+
+#ifndef PIN_RELAY
+#if defined(ESP8266)
+#define PIN_RELAY D6
+#elif defined(ESP32)
+#define PIN_RELAY 26
+#else
+#define PIN_RELAY 1
+#endif
+#endif
+
+#ifndef PIN_FLOW
+#if defined(ESP8266)
+#define PIN_FLOW D5
+#elif defined(ESP32)
+#define PIN_FLOW 27
+#else
+#define PIN_FLOW 2
+#endif
+#endif
+
+const int pinIgro = PIN_IGRO;  // igro
+const int pinRelay = PIN_RELAY; // valve relay
+const int pinFlow = PIN_FLOW;   // flow sensor pulses
+unsigned long valveDurationMs = 0; // Duration setted for which the valve should be open (in milliseconds)
+float valveTargetLiters = 0; // Volume after which the valve closes, 0 = time only
+
+// Defaults
+const unsigned long valveSecurityStop = 45UL * 60UL * 1000UL; // 45 minutes
+unsigned int defaultDurationMinutes = 10; // Default value when Valve turned on without a duration
+float flowPulsesPerLiter = 450.0f; // YF-S201 style sensor (F = 7.5 * Q)
+unsigned int defaultMoistureLimit = 150; // Default value for skipping irrigation if soil moisture is above limit when valve is turned on without a limit
+#if defined(ESP8266)
+int soilMoistureCalibrationMin = 300;
+int soilMoistureCalibrationMax = 1023;
+#elif defined(ESP32)
+int soilMoistureCalibrationMin = 1200;
+int soilMoistureCalibrationMax = 4095;
+#else
+int soilMoistureCalibrationMin = 300; // Host builds emulate the ESP8266 10-bit ADC
+int soilMoistureCalibrationMax = 1023;
+#endif
+
+// Intervals
+unsigned long sensorInfoPublishIntervalMs = 10UL * 60UL * 1000UL;   // Sensor data publishing interval
+unsigned long soilReadsIntervalMs = 5UL * 60UL * 1000UL;            // minimum interval between every soil moisture reads
+
+// Timings 
+uint32_t lastValveStartTime = 0;
+uint32_t lastSensorInfoPublished = 0;
+uint32_t lastMoistureReadTime = 0; // Last millis soil moisture was read
+SoilReadingDoc lastMoistureData;
+
+String getUptime()
+{
+    unsigned long ms = millis() / 1000;
+    unsigned int days = ms / 86400;
+    unsigned int hours = (ms % 86400) / 3600;
+    unsigned int minutes = (ms % 3600) / 60;
+    unsigned int seconds = ms % 60;
+
+    char formatted[20];
+
+    if (days > 0)
+    {
+        sprintf(formatted, "%u days %02u:%02u:%02u", days, hours, minutes, seconds);
+    }
+    else
+    {
+        sprintf(formatted, "%02u:%02u:%02u", hours, minutes, seconds);
+    }
+
+    return formatted;
+}
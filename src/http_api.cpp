@@ -0,0 +1,260 @@
+#include <Arduino.h>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include "http_api.h"
+#include "globals.h"
+#include "mqtt.h"
+#include "moisture_trend.h"
+
+// Local JSON API served next to fauxmo on port 80.
+// Responses are rendered from loop() when the underlying state changes and
+// served as-is, so a request never touches the ADC or the MQTT link.
+
+extern PubSubClient mqttClient;
+
+struct CachedResponse
+{
+    char body[640];
+    size_t length;
+};
+
+static CachedResponse cachedData;
+static CachedResponse cachedRelay;
+static CachedResponse cachedConfig;
+static CachedResponse cachedMetrics;
+
+// Async handlers run in the TCP task on ESP32, concurrently with loop()
+#if defined(ESP32)
+static portMUX_TYPE cacheMux = portMUX_INITIALIZER_UNLOCKED;
+#define CACHE_LOCK() portENTER_CRITICAL(&cacheMux)
+#define CACHE_UNLOCK() portEXIT_CRITICAL(&cacheMux)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#endif
+
+const unsigned long metricsRenderIntervalMs = 1000;
+
+static uint32_t renderedMoistureReadTime = 0;
+static int renderedRelayState = -1;
+static unsigned long renderedConfigHash = 0;
+static uint32_t lastMetricsRender = 0;
+
+static volatile unsigned long httpRequests = 0;
+static volatile unsigned long httpValveCommands = 0;
+
+// Valve commands are executed from loop(), never from the TCP callback
+static StaticJsonDocument<128> pendingValveCommand;
+static volatile bool valveCommandPending = false;
+
+static void storeResponse(CachedResponse &cache, const JsonDocument &doc)
+{
+    char buffer[sizeof(cache.body)];
+    size_t len = serializeJson(doc, buffer, sizeof(buffer));
+
+    CACHE_LOCK();
+    memcpy(cache.body, buffer, len);
+    cache.length = len;
+    CACHE_UNLOCK();
+}
+
+static void sendCached(AsyncWebServerRequest *request, const CachedResponse &cache)
+{
+    char buffer[sizeof(cache.body) + 1];
+
+    CACHE_LOCK();
+    size_t len = cache.length;
+    memcpy(buffer, cache.body, len);
+    CACHE_UNLOCK();
+
+    buffer[len] = '\0';
+    httpRequests++;
+    request->send(200, "application/json", buffer);
+}
+
+static void renderData()
+{
+    StaticJsonDocument<256> doc;
+    doc["igro"] = lastMoistureData;
+    doc["relay"]["relay_state"] = digitalRead(pinRelay);
+    storeResponse(cachedData, doc);
+}
+
+static void renderRelay()
+{
+    StaticJsonDocument<128> doc;
+    bool open = digitalRead(pinRelay) == HIGH;
+    doc["relay_state"] = open ? 1 : 0;
+    if (open)
+    {
+        uint32_t elapsed = millis() - lastValveStartTime;
+        doc["open_ms"] = elapsed;
+        doc["remaining_ms"] = elapsed < valveDurationMs ? valveDurationMs - elapsed : 0;
+    }
+    storeResponse(cachedRelay, doc);
+}
+
+static void renderConfig()
+{
+    StaticJsonDocument<256> doc;
+    doc["igro_min"] = soilMoistureCalibrationMin;
+    doc["igro_max"] = soilMoistureCalibrationMax;
+    doc["moistureSensorInterval_minutes"] = soilReadsIntervalMs / 60000UL;
+    doc["sensorDataInterval_minutes"] = sensorInfoPublishIntervalMs / 60000UL;
+    doc["defaultDuration_minutes"] = defaultDurationMinutes;
+    doc["defaultMoistureLimit"] = defaultMoistureLimit;
+    doc["valveSecurityStop_minutes"] = valveSecurityStop / 60000UL;
+    doc["flowPulsesPerLiter"] = flowPulsesPerLiter;
+    doc["trendShortWindow"] = moistureTrendWindowSize(0);
+    doc["trendLongWindow"] = moistureTrendWindowSize(1);
+    storeResponse(cachedConfig, doc);
+}
+
+static void renderMetrics()
+{
+    StaticJsonDocument<640> doc;
+    doc["uptime"] = getUptime();
+    doc["uptime_ms"] = millis();
+    doc["free_heap"] = ESP.getFreeHeap();
+    doc["rssi_db"] = WiFi.RSSI();
+    doc["device_ip"] = deviceIP.c_str();
+    doc["mqtt_connected"] = mqttClient.connected();
+    doc["http_requests"] = httpRequests;
+    doc["http_valve_commands"] = httpValveCommands;
+
+    JsonObject commands = doc.createNestedObject("mqtt_commands");
+    commands["accepted"] = commandStats.accepted;
+    commands["parse_errors"] = commandStats.parseErrors;
+    commands["too_large"] = commandStats.tooLarge;
+    commands["missing_command"] = commandStats.missingCommand;
+    commands["unknown"] = commandStats.unknownCommand;
+    commands["rate_limited"] = commandStats.rateLimited;
+    commands["debounced"] = commandStats.debounced;
+    commands["coalesced"] = commandStats.coalesced;
+
+    const MqttQueueStats &queueStats = mqttQueueStats();
+    JsonObject queue = doc.createNestedObject("mqtt_queue");
+    queue["depth"] = mqttQueueDepth();
+    queue["bytes"] = mqttQueueBytes();
+    queue["high_water"] = queueStats.highWater;
+    queue["sent"] = queueStats.sent;
+    queue["dropped"] = queueStats.dropped;
+    queue["coalesced"] = queueStats.coalesced;
+    queue["retries"] = queueStats.retries;
+    storeResponse(cachedMetrics, doc);
+}
+
+static unsigned long configHash()
+{
+    unsigned long h = 17;
+    h = h * 31 + (unsigned long)soilMoistureCalibrationMin;
+    h = h * 31 + (unsigned long)soilMoistureCalibrationMax;
+    h = h * 31 + soilReadsIntervalMs;
+    h = h * 31 + sensorInfoPublishIntervalMs;
+    h = h * 31 + defaultDurationMinutes;
+    h = h * 31 + defaultMoistureLimit;
+    uint32_t pulsesBits;
+    memcpy(&pulsesBits, &flowPulsesPerLiter, sizeof(pulsesBits));
+    h = h * 31 + pulsesBits;
+    for (uint8_t i = 0; i < trendWindowCount; i++)
+        h = h * 31 + moistureTrendWindowSize(i);
+    return h;
+}
+
+static void handleValve(AsyncWebServerRequest *request)
+{
+    httpRequests++;
+
+    if (!request->hasParam("state", true) && !request->hasParam("state"))
+    {
+        request->send(400, "application/json", "{\"with_err\":true,\"message\":\"Missing 'state'\"}");
+        return;
+    }
+
+    if (valveCommandPending)
+    {
+        request->send(409, "application/json", "{\"with_err\":true,\"message\":\"Valve command already pending\"}");
+        return;
+    }
+
+    bool isPost = request->hasParam("state", true);
+    String state = request->getParam("state", isPost)->value();
+    state.toLowerCase();
+    if (state != "on" && state != "off")
+    {
+        request->send(400, "application/json", "{\"with_err\":true,\"message\":\"'state' must be on or off\"}");
+        return;
+    }
+
+    pendingValveCommand.clear();
+    pendingValveCommand["command"] = "setValve";
+    pendingValveCommand["state"] = state;
+    if (request->hasParam("minutes", isPost))
+        pendingValveCommand["minutes"] = request->getParam("minutes", isPost)->value().toInt();
+    if (request->hasParam("liters", isPost))
+        pendingValveCommand["liters"] = request->getParam("liters", isPost)->value().toFloat();
+    if (request->hasParam("moistureLimit", isPost))
+        pendingValveCommand["moistureLimit"] = request->getParam("moistureLimit", isPost)->value().toInt();
+    valveCommandPending = true;
+
+    request->send(202, "application/json", "{\"with_err\":false,\"message\":\"Valve command accepted\"}");
+}
+
+void httpApiSetup(AsyncWebServer &server)
+{
+    renderData();
+    renderRelay();
+    renderConfig();
+    renderMetrics();
+
+    server.on("/api/data", HTTP_GET, [](AsyncWebServerRequest *request) { sendCached(request, cachedData); });
+    server.on("/api/relay", HTTP_GET, [](AsyncWebServerRequest *request) { sendCached(request, cachedRelay); });
+    server.on("/api/config", HTTP_GET, [](AsyncWebServerRequest *request) { sendCached(request, cachedConfig); });
+    server.on("/api/metrics", HTTP_GET, [](AsyncWebServerRequest *request) { sendCached(request, cachedMetrics); });
+    server.on("/api/valve", HTTP_POST, handleValve);
+}
+
+void httpApiLoop()
+{
+    if (valveCommandPending)
+    {
+        httpValveCommands++;
+        runCommand("setValve", pendingValveCommand);
+        valveCommandPending = false;
+    }
+
+    uint32_t now = millis();
+    int relayState = digitalRead(pinRelay);
+    bool relayChanged = relayState != renderedRelayState;
+
+    if (relayChanged || lastMoistureReadTime != renderedMoistureReadTime)
+    {
+        renderedMoistureReadTime = lastMoistureReadTime;
+        renderData();
+    }
+
+    // Open valves report a countdown, so keep their state fresh
+    if (relayChanged || (relayState == HIGH && now - lastMetricsRender >= metricsRenderIntervalMs))
+    {
+        renderedRelayState = relayState;
+        renderRelay();
+    }
+
+    unsigned long hash = configHash();
+    if (hash != renderedConfigHash)
+    {
+        renderedConfigHash = hash;
+        renderConfig();
+    }
+
+    if (now - lastMetricsRender >= metricsRenderIntervalMs)
+    {
+        lastMetricsRender = now;
+        renderMetrics();
+    }
+}
@@ -11,10 +11,14 @@
 #include <WiFiManager.h>
 #include <NTPClient.h>
 #include <fauxmoESP.h>
+#include <ESPAsyncWebServer.h>
+
+#include "mqtt_tls.h"
 
 // Modules inits
 fauxmoESP fauxmo;                   // Alexa
-WiFiClient espClient;               // WiFi
+AsyncWebServer webServer(80);       // Alexa + local HTTP API
+MqttNetClient espClient;            // WiFi (TLS with -DMQTT_USE_TLS)
 PubSubClient mqttClient(espClient); // MQTT
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, "it.pool.ntp.org");
@@ -24,55 +28,18 @@ NTPClient timeClient(ntpUDP, "it.pool.ntp.org");
 #include "sensors.h"
 #include "wifi_utils.h"
 #include "mqtt.h"
+#include "http_api.h"
+#include "ota.h"
+#include "flow_meter.h"
+#if defined(SMARTKLER_GATEWAY)
+#include "gateway.h"
 
-// Global defines
-String deviceID;
-String deviceIP;
-Topics topics;
-
-#ifndef PIN_IGRO
-#if defined(ESP8266)
-#define PIN_IGRO A0
-#elif defined(ESP32)
-#define PIN_IGRO 34
-#endif
-#endif
-
-#ifndef PIN_RELAY
-#if defined(ESP8266)
-#define PIN_RELAY D6
-#elif defined(ESP32)
-#define PIN_RELAY 26
-#endif
-#endif
-
-const int pinIgro = PIN_IGRO;  // igro
-const int pinRelay = PIN_RELAY; // valve relay
-unsigned long valveDurationMs = 0; // Duration setted for which the valve should be open (in milliseconds)
-
-// Defaults
-const unsigned long valveSecurityStop = 45UL * 60UL * 1000UL; // 45 minutes
-unsigned int defaultDurationMinutes = 10; // Default value when Valve turned on without a duration
-unsigned int defaultMoistureLimit = 150; // Default value for skipping irrigation if soil moisture is above limit when valve is turned on without a limit
-#if defined(ESP8266)
-int soilMoistureCalibrationMin = 300;
-int soilMoistureCalibrationMax = 1023;
-#elif defined(ESP32)
-int soilMoistureCalibrationMin = 1200;
-int soilMoistureCalibrationMax = 4095;
+EspNowLink nodeLink;                // Battery sensor nodes
 #endif
 
-// Intervals
+// Loop timings
 const unsigned long loopIntervalMs = 2UL * 1000UL;                  // Loop interval
-unsigned long sensorInfoPublishIntervalMs = 10UL * 60UL * 1000UL;   // Sensor data publishing interval
-unsigned long soilReadsIntervalMs = 5UL * 60UL * 1000UL;            // minimum interval between every soil moisture reads
-
-// Timings 
-unsigned long lastLoopTick = 0;
-unsigned long lastValveStartTime = 0;
-unsigned long lastSensorInfoPublished = 0;
-unsigned long lastMoistureReadTime = 0; // Last millis soil moisture was read
-StaticJsonDocument<128> lastMoistureData;
+uint32_t lastLoopTick = 0;
 
 unsigned long GetEpochTime()
 {
@@ -81,54 +48,26 @@ unsigned long GetEpochTime()
   return now;
 }
 
-String getUptime()
-{
-    unsigned long ms = millis() / 1000;
-    unsigned int days = ms / 86400;
-    unsigned int hours = (ms % 86400) / 3600;
-    unsigned int minutes = (ms % 3600) / 60;
-    unsigned int seconds = ms % 60;
-
-    char formatted[20];
-
-    if (days > 0)
-    {
-        sprintf(formatted, "%u days %02u:%02u:%02u", days, hours, minutes, seconds);
-    }
-    else
-    {
-        sprintf(formatted, "%02u:%02u:%02u", hours, minutes, seconds);
-    }
-
-    return formatted;
-}
-
-void OTASetup() {
-    ArduinoOTA.setHostname(("smartkler-" + deviceID).c_str());
-    ArduinoOTA.onStart([]()
-    { 
-        publishSystemEvent("OTA Update Started", "ota_start");
-        Serial.println("OTA Start");
-    });
-
-    ArduinoOTA.onEnd([]() {
-        Serial.println("OTA End");
-    });
-
-    ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-        Serial.printf("OTA Progress: %u%%\r", (progress / (total / 100)));
+void fauxmoSetup() {
+    // Shared web server: the local API routes first, everything else goes to fauxmo
+    webServer.onRequestBody([](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        // data is not NUL-terminated
+        String body;
+        body.concat((const char *)data, len);
+        fauxmo.process(request->client(), request->method() == HTTP_GET, request->url(), body);
     });
-
-    ArduinoOTA.onError([](ota_error_t error) {
-        Serial.printf("OTA Error[%u]\n", error);
+    webServer.onNotFound([](AsyncWebServerRequest *request) {
+        String body = request->hasParam("body", true) ? request->getParam("body", true)->value() : String();
+        if (!fauxmo.process(request->client(), request->method() == HTTP_GET, request->url(), body))
+        {
+            request->send(404, "application/json", "{\"with_err\":true,\"message\":\"Not found\"}");
+        }
     });
+    httpApiSetup(webServer);
+    webServer.begin();
 
-    ArduinoOTA.begin();
-}
-
-void fauxmoSetup() {
-    fauxmo.createServer(true); // Internal web server
-    fauxmo.setPort(80);        // Required for Alexa
+    fauxmo.createServer(false); // Requests come from webServer
+    fauxmo.setPort(80);         // Required for Alexa
     fauxmo.enable(true);
 
     fauxmo.addDevice(("Irrigatore " + deviceID).c_str()); // Device name that will appear in Alexa app
@@ -141,6 +80,7 @@ void fauxmoSetup() {
       if (state)
       {
         valveDurationMs = (unsigned long)defaultDurationMinutes * 60000UL;
+        valveTargetLiters = 0;
         lastValveStartTime = millis();
       }
 
@@ -174,6 +114,8 @@ void setup()
   // Deactivate Relay on startup to ensure valve is closed when system reboots
   digitalWrite(pinRelay, LOW);
 
+  flowMeterSetup();
+
   connectToWiFi();
   connectToMQTT();
 
@@ -206,6 +148,11 @@ void setup()
   // OTA setup
   OTASetup();
 
+#if defined(SMARTKLER_GATEWAY)
+  // ESP-NOW shares the radio: nodes must use the channel of this WiFi network
+  gatewaySetup(nodeLink);
+#endif
+
   Serial.println("Device ID: " + deviceID);
   Serial.printf("Device IP: %s\n", deviceIP.c_str());
 
@@ -216,12 +163,20 @@ void setup()
 void loop()
 {
     mqttClient.loop();
+    mqttProcessQueue();
     ArduinoOTA.handle();
+    otaLoop();
     fauxmo.handle();
+    httpApiLoop();
+    flowMeterLoop();
     checkValveWatchdog();
     processDeferredSensorPublish();
+    processPendingDataRequest();
+#if defined(SMARTKLER_GATEWAY)
+    gatewayLoop();
+#endif
 
-    unsigned long now = millis();
+    uint32_t now = millis();
 
     if (now - lastSensorInfoPublished >= sensorInfoPublishIntervalMs)
     {
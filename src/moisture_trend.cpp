@@ -0,0 +1,242 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <math.h>
+#include "moisture_trend.h"
+#include "globals.h"
+
+struct TrendWindow
+{
+    uint16_t size;
+    uint16_t count;
+
+    // Sums over the window; time is in seconds since the oldest sample in the
+    // window, re-based whenever that sample is evicted. count * sumTT is at
+    // most 127^2 * span^2, which fits in 64 bits for any window spanning less
+    // than ~2.4e7 s (276 days), however long the device has been up.
+    uint32_t baseTimeS;
+    int64_t sumY;
+    int64_t sumYY;
+    int64_t sumT;
+    int64_t sumTT;
+    int64_t sumTY;
+
+    // Monotonic queues of sample sequence numbers (mod 2^16)
+    uint16_t minQueue[trendHistoryCapacity];
+    uint16_t maxQueue[trendHistoryCapacity];
+    uint16_t minHead, minLen;
+    uint16_t maxHead, maxLen;
+};
+
+static int16_t historyValue[trendHistoryCapacity];
+static uint32_t historyTimeS[trendHistoryCapacity];
+static uint16_t nextSeq = 0;      // sequence number of the next sample
+static uint16_t storedSamples = 0; // valid entries in the ring
+
+static uint32_t trendClockS = 0;
+static uint32_t trendClockRemainderMs = 0;
+static uint32_t lastTrendSampleMs = 0;
+
+static TrendWindow windows[trendWindowCount] = {
+    {12, 0},  // 1 hour at the default 5 minute read interval
+    {96, 0},  // 8 hours
+};
+
+static inline uint16_t ringIndex(uint16_t seq)
+{
+    return seq % trendHistoryCapacity; // capacity divides 2^16
+}
+
+// Moves the time origin forward by shiftS without touching the samples
+static void windowRebase(TrendWindow &w, uint32_t shiftS)
+{
+    int64_t d = shiftS;
+    w.sumTT += -2 * d * w.sumT + (int64_t)w.count * d * d;
+    w.sumTY -= d * w.sumY;
+    w.sumT -= (int64_t)w.count * d;
+    w.baseTimeS += shiftS;
+}
+
+static void windowPush(TrendWindow &w, uint16_t seq)
+{
+    if (w.count == 0)
+        w.baseTimeS = historyTimeS[ringIndex(seq)];
+
+    int64_t y = historyValue[ringIndex(seq)];
+
+    if (w.count == w.size)
+    {
+        uint16_t oldSeq = seq - w.size;
+        int64_t oy = historyValue[ringIndex(oldSeq)];
+        int64_t ot = historyTimeS[ringIndex(oldSeq)] - w.baseTimeS;
+        w.sumY -= oy;
+        w.sumYY -= oy * oy;
+        w.sumT -= ot;
+        w.sumTT -= ot * ot;
+        w.sumTY -= ot * oy;
+        w.count--;
+
+        windowRebase(w, historyTimeS[ringIndex(oldSeq + 1)] - w.baseTimeS);
+
+        if (w.minLen && w.minQueue[w.minHead] == oldSeq)
+        {
+            w.minHead = (w.minHead + 1) % trendHistoryCapacity;
+            w.minLen--;
+        }
+        if (w.maxLen && w.maxQueue[w.maxHead] == oldSeq)
+        {
+            w.maxHead = (w.maxHead + 1) % trendHistoryCapacity;
+            w.maxLen--;
+        }
+    }
+
+    int64_t t = historyTimeS[ringIndex(seq)] - w.baseTimeS;
+    w.sumY += y;
+    w.sumYY += y * y;
+    w.sumT += t;
+    w.sumTT += t * t;
+    w.sumTY += t * y;
+    w.count++;
+
+    while (w.minLen && historyValue[ringIndex(w.minQueue[(w.minHead + w.minLen - 1) % trendHistoryCapacity])] >= y)
+        w.minLen--;
+    w.minQueue[(w.minHead + w.minLen) % trendHistoryCapacity] = seq;
+    w.minLen++;
+
+    while (w.maxLen && historyValue[ringIndex(w.maxQueue[(w.maxHead + w.maxLen - 1) % trendHistoryCapacity])] <= y)
+        w.maxLen--;
+    w.maxQueue[(w.maxHead + w.maxLen) % trendHistoryCapacity] = seq;
+    w.maxLen++;
+}
+
+static void windowRebuild(TrendWindow &w)
+{
+    uint16_t size = w.size;
+    memset(&w, 0, sizeof(w));
+    w.size = size;
+
+    uint16_t replay = storedSamples < size ? storedSamples : size;
+    for (uint16_t i = replay; i > 0; i--)
+        windowPush(w, nextSeq - i);
+}
+
+bool moistureTrendAddSample(int raw, uint32_t nowMs)
+{
+    // Forced reads between the periodic ones would crowd the windows with
+    // samples seconds apart, shrinking the span the slope is fitted over
+    if (storedSamples > 0 && nowMs - lastTrendSampleMs < soilReadsIntervalMs)
+        return false;
+
+    // Own seconds counter so millis() wrap-around does not break the fit
+    if (storedSamples > 0)
+    {
+        uint32_t elapsed = nowMs - lastTrendSampleMs + trendClockRemainderMs;
+        trendClockS += elapsed / 1000UL;
+        trendClockRemainderMs = elapsed % 1000UL;
+    }
+    lastTrendSampleMs = nowMs;
+
+    long centi = map(raw, soilMoistureCalibrationMax, soilMoistureCalibrationMin, 0, 10000);
+    centi = constrain(centi, 0L, 10000L);
+
+    uint16_t seq = nextSeq++;
+    historyValue[ringIndex(seq)] = (int16_t)centi;
+    historyTimeS[ringIndex(seq)] = trendClockS;
+    if (storedSamples < trendHistoryCapacity)
+        storedSamples++;
+
+    for (uint8_t i = 0; i < trendWindowCount; i++)
+        windowPush(windows[i], seq);
+    return true;
+}
+
+bool moistureTrendGetStats(uint8_t window, TrendStats &stats)
+{
+    if (window >= trendWindowCount || windows[window].count == 0)
+        return false;
+
+    const TrendWindow &w = windows[window];
+    double n = w.count;
+
+    stats.count = w.count;
+    stats.min = historyValue[ringIndex(w.minQueue[w.minHead])];
+    stats.max = historyValue[ringIndex(w.maxQueue[w.maxHead])];
+    stats.mean = (float)(w.sumY / n / 100.0);
+
+    double variance = ((double)w.count * w.sumYY - (double)w.sumY * w.sumY) / (n * n);
+    stats.stddev = variance > 0 ? (float)(sqrt(variance) / 100.0) : 0.0f;
+
+    // Least squares slope, exact integer numerator/denominator
+    int64_t denominator = (int64_t)w.count * w.sumTT - w.sumT * w.sumT;
+    int64_t numerator = (int64_t)w.count * w.sumTY - w.sumT * w.sumY;
+    stats.slopePerHour = denominator > 0 ? (float)((double)numerator / denominator * 3600.0 / 100.0) : 0.0f;
+
+    return true;
+}
+
+bool moistureTrendSetWindowSize(uint8_t window, uint16_t samples)
+{
+    if (window >= trendWindowCount || samples < 2 || samples >= trendHistoryCapacity)
+        return false;
+
+    windows[window].size = samples;
+    windowRebuild(windows[window]);
+    return true;
+}
+
+uint16_t moistureTrendWindowSize(uint8_t window)
+{
+    return window < trendWindowCount ? windows[window].size : 0;
+}
+
+long moistureTrendMinutesToLimit(unsigned int limitPercent)
+{
+    const TrendWindow &w = windows[trendWindowCount - 1];
+    TrendStats stats;
+
+    // Limits above 100 (the default 150) turn the moisture check off
+    if (limitPercent > 100)
+        return -1;
+    if (w.count < 3 || !moistureTrendGetStats(trendWindowCount - 1, stats))
+        return -1;
+
+    // Fitted value at the latest sample rather than the noisy raw reading
+    double meanT = (double)w.sumT / w.count;
+    double latestT = historyTimeS[ringIndex(nextSeq - 1)] - w.baseTimeS;
+    double fitted = stats.mean + stats.slopePerHour * (latestT - meanT) / 3600.0;
+
+    if (fitted <= limitPercent)
+        return 0;
+    if (stats.slopePerHour >= 0)
+        return -1; // not drying
+
+    return (long)((fitted - limitPercent) / -stats.slopePerHour * 60.0);
+}
+
+static void statsToJson(JsonObject out, const TrendStats &stats)
+{
+    out["n"] = stats.count;
+    out["min"] = stats.min / 100.0f;
+    out["max"] = stats.max / 100.0f;
+    out["mean"] = roundf(stats.mean * 10.0f) / 10.0f;
+    out["sd"] = roundf(stats.stddev * 10.0f) / 10.0f;
+    out["slope_h"] = roundf(stats.slopePerHour * 100.0f) / 100.0f;
+}
+
+void moistureTrendToJson(JsonObject out)
+{
+    static const char *const names[trendWindowCount] = {"short", "long"};
+    TrendStats stats;
+
+    for (uint8_t i = 0; i < trendWindowCount; i++)
+    {
+        if (moistureTrendGetStats(i, stats))
+            statsToJson(out.createNestedObject(names[i]), stats);
+    }
+
+    long minutes = moistureTrendMinutesToLimit(defaultMoistureLimit);
+    out["limit"] = defaultMoistureLimit;
+    if (minutes >= 0)
+        out["minutes_to_limit"] = minutes;
+    else
+        out["minutes_to_limit"] = nullptr;
+}
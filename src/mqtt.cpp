@@ -1,8 +1,11 @@
 #if defined(ESP8266)
 #include <ESP8266WiFi.h>
+#include <umm_malloc/umm_malloc.h>
 #elif defined(ESP32)
 #include <WiFi.h>
 #include <esp_sleep.h>
+#elif defined(SMARTKLER_HOST)
+#include <WiFi.h>
 #endif
 #include <PubSubClient.h>
 #include <map>
@@ -11,22 +14,60 @@
 #include "mqtt.h"
 #include "globals.h"
 #include "sensors.h"
+#include "ota.h"
+#include "moisture_trend.h"
+#include "flow_meter.h"
+#include "command_admission.h"
+#include "mqtt_tls.h"
+#if defined(SMARTKLER_GATEWAY)
+#include "gateway.h"
+#endif
 #include "secrets.h"
 
 // Forward declaration for sensors functions
 int setRelayState(bool state);
 
-std::map<String, std::function<void(const JsonDocument &)>> commandHandlers;
+struct CommandHandler
+{
+  const char *const *fields; // nullptr-terminated, the only keys kept when parsing
+  CommandClass commandClass; // selects the admission token bucket
+  std::function<void(const JsonDocument &)> run;
+};
+
+std::map<String, CommandHandler> commandHandlers;
+CommandStats commandStats;
+
+const unsigned int commandMaxPayloadBytes = 512;
+const uint8_t commandMaxNesting = 4;
+const size_t commandMaxFields = 8;
+
+// Time loop() may spend sending queued messages per iteration
+const unsigned long mqttSendBudgetMs = 20;
+
+static const char *const setConfigParamFields[] = {"igro_min", "igro_max", "moistureSensorInterval_minutes",
+                                                   "sensorDataInterval_minutes", "flowPulsesPerLiter",
+                                                   "trendShortWindow", "trendLongWindow", "defaultMoistureLimit",
+                                                   nullptr};
+static const char *const setValveFields[] = {"state", "minutes", "moistureLimit", "liters", nullptr};
+static const char *const getDataFields[] = {"force", nullptr};
+static const char *const otaUpdateFields[] = {"url", "md5", "jitter_s", nullptr};
+static const char *const noFields[] = {nullptr};
+#if defined(SMARTKLER_GATEWAY)
+static const char *const setNodeValveFields[] = {"node", "state", "minutes", nullptr};
+#endif
 
 // Client WiFi e MQTT
-extern WiFiClient espClient;
 extern PubSubClient mqttClient;
 
-String clientId = "Smartkler-" + getDeviceId();
+#if defined(MQTT_USE_TLS)
+const uint16_t mqttBrokerPort = MQTT_TLS_PORT;
+#else
+const uint16_t mqttBrokerPort = MQTT_PORT;
+#endif
 
 void initMQTThandlers()
 {
-  commandHandlers["setConfigParam"] = [](const JsonDocument &doc)
+  commandHandlers["setConfigParam"] = {setConfigParamFields, COMMAND_CLASS_CONFIG, [](const JsonDocument &doc)
   {
     bool anyChange = false;
 
@@ -72,6 +113,19 @@ void initMQTThandlers()
       }
     }
 
+    if (doc.containsKey("flowPulsesPerLiter"))
+    {
+      float newPpl = doc["flowPulsesPerLiter"];
+
+      if (newPpl > 0 && newPpl != flowPulsesPerLiter)
+      {
+        responseDoc["flowPulsesPerLiter_old"] = flowPulsesPerLiter;
+        flowPulsesPerLiter = newPpl;
+        responseDoc["flowPulsesPerLiter_new"] = flowPulsesPerLiter;
+        anyChange = true;
+      }
+    }
+
     if (doc.containsKey("sensorDataInterval_minutes"))
     {
       unsigned long newValMin = doc["sensorDataInterval_minutes"];
@@ -86,16 +140,52 @@ void initMQTThandlers()
       }
     }
 
-    if (!anyChange)
+    if (doc.containsKey("defaultMoistureLimit"))
+    {
+      unsigned int newLimit = doc["defaultMoistureLimit"];
+      if (newLimit != defaultMoistureLimit)
+      {
+        responseDoc["defaultMoistureLimit_old"] = defaultMoistureLimit;
+        defaultMoistureLimit = newLimit;
+        responseDoc["defaultMoistureLimit_new"] = defaultMoistureLimit;
+        anyChange = true;
+      }
+    }
+
+    const char *trendWindowKeys[trendWindowCount] = {"trendShortWindow", "trendLongWindow"};
+    for (uint8_t i = 0; i < trendWindowCount; i++)
+    {
+      if (!doc.containsKey(trendWindowKeys[i]))
+        continue;
+
+      uint16_t oldSize = moistureTrendWindowSize(i);
+      uint16_t newSize = doc[trendWindowKeys[i]];
+      if (newSize == oldSize)
+        continue;
+
+      if (moistureTrendSetWindowSize(i, newSize))
+      {
+        responseDoc[String(trendWindowKeys[i]) + "_old"] = oldSize;
+        responseDoc[String(trendWindowKeys[i]) + "_new"] = newSize;
+        anyChange = true;
+      }
+      else
+      {
+        responseDoc["with_err"] = true;
+        responseDoc["message"] = "Trend window must be between 2 and " + String(trendHistoryCapacity - 1) + " samples.";
+      }
+    }
+
+    if (!anyChange && !responseDoc["with_err"].as<bool>())
     {
       responseDoc["with_err"] = true;
       responseDoc["message"] = "No configuration changes applied.";
     }
 
     mqttPublish(topics.systemEvents.c_str(), responseDoc);
-  };
+  }};
   
-  commandHandlers["setValve"] = [](const JsonDocument &doc)
+  commandHandlers["setValve"] = {setValveFields, COMMAND_CLASS_VALVE, [](const JsonDocument &doc)
   {
     if (!doc.containsKey("state"))
       return;
@@ -107,9 +197,13 @@ void initMQTThandlers()
     {
       int minutes = doc["minutes"] | defaultDurationMinutes;
       int maxMoisture = doc["moistureLimit"] | defaultMoistureLimit;
+      float liters = doc["liters"] | 0.0f;
 
       Serial.printf("Turning valve ON for %d min if soil moisture is < %d%% \n", minutes, maxMoisture);
+      if (liters > 0)
+        Serial.printf("Valve will close after %.2f liters\n", liters);
       valveDurationMs = (unsigned long)minutes * 60000;
+      valveTargetLiters = liters;
       lastValveStartTime = millis(); // Start timer
       setRelayState(true);
     }
@@ -118,51 +212,134 @@ void initMQTThandlers()
       Serial.println("Turning valve OFF.");
       setRelayState(false);
     }
-  };
+  }};
 
-  commandHandlers["getData"] = [](const JsonDocument &doc)
+  commandHandlers["getData"] = {getDataFields, COMMAND_CLASS_QUERY, [](const JsonDocument &doc)
   {
-    publishSensorData(doc.containsKey("force") ? true : false);
-  };
+    // Served from loop(): a burst of requests becomes a single publish
+    bool force = doc.containsKey("force");
+    if (sensorPublishPending || !commandAdmissionQueueDataRequest(force))
+      commandStats.coalesced++;
+  }};
 
-  commandHandlers["shutdown-r"] = [](const JsonDocument &doc) {
+  commandHandlers["shutdown-r"] = {noFields, COMMAND_CLASS_SYSTEM, [](const JsonDocument &doc) {
     Serial.println("Restarting device...");
     publishSystemEvent("Smartkler Restarting", "system_rebooting");
-    delay(3000);
+    mqttFlushQueue(3000);
     ESP.restart();
-  };
+  }};
 
-  commandHandlers["shutdown-h"] = [](const JsonDocument &doc)
+  commandHandlers["shutdown-h"] = {noFields, COMMAND_CLASS_SYSTEM, [](const JsonDocument &doc)
   {
     Serial.println("System Shutdown...");
     publishSystemEvent("Smartkler Shutting Down", "system_shutting_down");
-    delay(3000);
+    mqttFlushQueue(3000);
 #if defined(ESP8266)
     ESP.deepSleep(0);
 #elif defined(ESP32)
     esp_deep_sleep_start();
 #endif
-  };
+  }};
+
+  commandHandlers["otaUpdate"] = {otaUpdateFields, COMMAND_CLASS_SYSTEM, [](const JsonDocument &doc)
+  {
+    if (!doc.containsKey("url"))
+    {
+      publishSystemEvent("OTA pull rejected: missing url", "ota_rejected");
+      return;
+    }
+
+    // An image is never flashed without a checksum to verify it against
+    const char *md5 = doc["md5"] | "";
+    if (strlen(md5) != 32 || strspn(md5, "0123456789abcdefABCDEF") != 32)
+    {
+      publishSystemEvent("OTA pull rejected: missing or malformed md5", "ota_rejected");
+      return;
+    }
+
+    scheduleOtaPull(doc["url"].as<String>(), md5, doc["jitter_s"] | 0UL);
+    publishSystemEvent("OTA pull scheduled", "ota_scheduled");
+  }};
 
-  commandHandlers["ping"] = [](const JsonDocument &doc)
+  commandHandlers["ping"] = {noFields, COMMAND_CLASS_QUERY, [](const JsonDocument &doc)
   {
     Serial.println("Ping request received");
     publishSystemEvent("PONG!", "ping_response");
-  };
+  }};
+
+#if defined(SMARTKLER_GATEWAY)
+  // Held by the gateway until the node wakes; the ack is published on topics.valve
+  commandHandlers["setNodeValve"] = {setNodeValveFields, COMMAND_CLASS_NODE, [](const JsonDocument &doc)
+  {
+    String state = doc["state"] | "";
+    state.toLowerCase();
+
+    if (state != "on" && state != "off")
+    {
+      publishSystemEvent("setNodeValve rejected: state must be on or off", "node_command_rejected");
+      return;
+    }
+
+    uint16_t minutes = doc["minutes"] | defaultDurationMinutes;
+    if (!gatewayQueueValveCommand(doc["node"] | "", state == "on", minutes))
+    {
+      publishSystemEvent("setNodeValve rejected: unknown node", "node_command_rejected");
+    }
+  }};
+#endif
 };
 
+// Free heap now; starts a new low-water mark where the platform allows it
+static uint32_t heapLowWaterReset()
+{
+#if defined(ESP8266)
+  return umm_free_heap_size_min_reset();
+#else
+  return ESP.getFreeHeap();
+#endif
+}
+
+// Lowest free heap since the last reset. ESP32 cannot reset the mark: an
+// earlier, deeper dip makes the handshake look more expensive than it was
+static uint32_t heapLowWater()
+{
+#if defined(ESP8266)
+  return umm_free_heap_size_min();
+#elif defined(ESP32)
+  return ESP.getMinFreeHeap();
+#else
+  return ESP.getFreeHeap();
+#endif
+}
+
 void connectToMQTT()
   {
     Serial.print("Attempting MQTT connection...");
     if (!mqttClient.connected())
     {
-      mqttClient.setServer(MQTT_SERVER, MQTT_PORT);
+      static bool transportConfigured = false;
+      if (!transportConfigured)
+      {
+#if defined(MQTT_USE_TLS)
+        mqttTlsSetup(MQTT_SERVER, mqttBrokerPort, MQTT_CA_CERT, MQTT_FINGERPRINT);
+#endif
+        transportConfigured = true;
+      }
+
+      String clientId = "Smartkler-" + getDeviceId();
+      mqttClient.setServer(MQTT_SERVER, mqttBrokerPort);
       mqttClient.setCallback(mqttCallback);
       mqttClient.setKeepAlive(30);
 
       initMQTThandlers();
-      
-      if (mqttClient.connect(
+
+      if (!mqttTlsBeforeConnect())
+        return;
+
+      uint32_t connectStart = millis();
+      uint32_t heapBefore = heapLowWaterReset();
+
+      bool connected = mqttClient.connect(
             clientId.c_str(),
             MQTT_USERNAME,
             MQTT_PASSWORD,
@@ -170,12 +347,31 @@ void connectToMQTT()
             1,                 // willQos
             true,              // willRetain
             "offline"          // willMessage
-          ))
+          );
+
+      uint32_t connectMs = millis() - connectStart;
+      uint32_t heapLow = heapLowWater();
+      bool tlsResumed = mqttTlsAfterConnect(connected);
+
+      if (connected)
       {
         Serial.println("connected to MQTT broker " + String(MQTT_SERVER));
         // Subscribe to topics after successful connection
         mqttSubscribe(topics.commands.c_str());
-        publishSystemEvent("MQTT connected", "mqtt_connected");
+
+        StaticJsonDocument<192> connectedDoc;
+        connectedDoc["action"] = "MQTT connected";
+        connectedDoc["action_code"] = "mqtt_connected";
+#if defined(MQTT_USE_TLS)
+        connectedDoc["tls"] = true;
+#else
+        connectedDoc["tls"] = false;
+#endif
+        connectedDoc["tls_resumed"] = tlsResumed;
+        connectedDoc["connect_ms"] = connectMs;
+        // Deepest point of the handshake, not what it still holds afterwards
+        connectedDoc["heap_peak_cost"] = heapBefore > heapLow ? heapBefore - heapLow : 0;
+        mqttPublish(topics.systemEvents.c_str(), connectedDoc);
         
         // LWT
         mqttClient.publish(topics.lwt.c_str(), "online", true);
@@ -263,144 +459,272 @@ void mqttSubscribe(const char *topic)
   Serial.println("Subscribed to topic: " + String(topic));
 }
 
-void mqttPublish(const char *topic, const JsonDocument &payload)
+static void reportPublishFailure(const char *topic)
 {
   static bool reportingPublishFailure = false;
-  StaticJsonDocument<512> doc;
 
-  unsigned long now = GetEpochTime();
+  if (reportingPublishFailure)
+    return;
+  reportingPublishFailure = true;
+
+  StaticJsonDocument<160> errorDoc;
+  errorDoc["action_code"] = "mqtt_publish_failed";
+  errorDoc["failed_topic"] = topic;
+
+  char errorBuffer[160];
+  size_t errorLen = serializeJson(errorDoc, errorBuffer);
+  bool errorOk = mqttClient.publish(topics.systemEvents.c_str(), (const uint8_t *)errorBuffer, errorLen, false);
+
+  if (!errorOk)
+  {
+    Serial.println(F("MQTT publish failure report also failed"));
+  }
+
+  reportingPublishFailure = false;
+}
+
+// Wraps a queued payload in the device envelope and publishes it. The
+// timestamp is taken back by the time spent queued, so it still marks the event.
+static MqttSendResult sendQueuedMessage(const char *topic, const char *payload, size_t length, unsigned long ageMs)
+{
+  if (!mqttClient.connected())
+    return MQTT_SEND_RETRY;
+
+  unsigned long now = GetEpochTime() - ageMs / 1000UL;
   char isoTime[25];
   time_t rawtime = (time_t)now;
   struct tm *timeinfo = gmtime(&rawtime);
   strftime(isoTime, sizeof(isoTime), "%Y-%m-%dT%H:%M:%SZ", timeinfo);
 
-  // Build wrapper
-  doc["timestamp"] = now;
-  doc["datetime"] = isoTime;
-  doc["uptime"] = getUptime();
-  doc["device_ip"] = deviceIP.c_str(); 
-
   int rssi = WiFi.RSSI();
   int quality = map(rssi, -90, -30, 0, 100); // clamp between 0–100%
   quality = constrain(quality, 0, 100);
-  doc["rssi_db"] = rssi;
-  doc["wifi_signal_quality_percent"] = quality;
-  
-  // Deep copy 'payload' into "data"
-  doc["data"] = payload;
 
-  // Serialize and publish
-  char buffer[512];
-  size_t len = serializeJson(doc, buffer);
-  //mqttClient.publish(topic, (const uint8_t *)buffer, len, false);
-  bool ok = mqttClient.publish(topic, (const uint8_t *)buffer, len, false);
+  static char buffer[MQTT_MAX_PACKET_SIZE];
+  int header = snprintf(buffer, sizeof(buffer),
+                        "{\"timestamp\":%lu,\"datetime\":\"%s\",\"uptime\":\"%s\",\"device_ip\":\"%s\","
+                        "\"rssi_db\":%d,\"wifi_signal_quality_percent\":%d,\"data\":",
+                        now, isoTime, getUptime().c_str(), deviceIP.c_str(), rssi, quality);
+
+  bool ok = false;
+  size_t len = 0;
+  if (header > 0 && (size_t)header + length + 1 < sizeof(buffer))
+  {
+    memcpy(buffer + header, payload, length);
+    buffer[header + length] = '}';
+    len = header + length + 1;
+    ok = mqttClient.publish(topic, (const uint8_t *)buffer, len, false);
+  }
 
   if (!ok)
   {
+    // A dropped link is retried after reconnecting; anything else will never fit
+    if (!mqttClient.connected())
+      return MQTT_SEND_RETRY;
+
     Serial.println(F("MQTT publish failed (packet too big?)"));
-    Serial.printf("Doc capacity: %d, used: %d\n", doc.capacity(), doc.memoryUsage());
+    Serial.printf("Payload: %u bytes, envelope: %d bytes\n", (unsigned int)length, header);
     Serial.print("MQTT_MAX_PACKET_SIZE = ");
     Serial.println(MQTT_MAX_PACKET_SIZE);
+    reportPublishFailure(topic);
+    return MQTT_SEND_DROP;
+  }
 
-    if (!reportingPublishFailure)
-    {
-      reportingPublishFailure = true;
+  Serial.printf("Published to %s: %.*s\n", topic, (int)len, buffer);
+  return MQTT_SEND_OK;
+}
 
-      StaticJsonDocument<160> errorDoc;
-      errorDoc["action_code"] = "mqtt_publish_failed";
-      errorDoc["failed_topic"] = topic;
+static MqttPriority priorityForTopic(const char *topic)
+{
+  if (topics.valve == topic)
+    return MQTT_PRIORITY_SAFETY;
+  if (topics.data == topic)
+    return MQTT_PRIORITY_TELEMETRY;
+  return MQTT_PRIORITY_SYSTEM;
+}
 
-      char errorBuffer[160];
-      size_t errorLen = serializeJson(errorDoc, errorBuffer);
-      bool errorOk = mqttClient.publish(topics.systemEvents.c_str(), (const uint8_t *)errorBuffer, errorLen, false);
+void mqttPublish(const char *topic, const JsonDocument &payload, MqttPriority priority)
+{
+  // A full document silently loses members: report it instead of sending part of it
+  if (payload.overflowed())
+  {
+    Serial.printf("MQTT payload for %s overflowed its %u byte document, not sent\n", topic,
+                  (unsigned int)payload.capacity());
+    StaticJsonDocument<JSON_OBJECT_SIZE(2)> errorDoc;
+    errorDoc["action_code"] = "mqtt_payload_overflow";
+    errorDoc["failed_topic"] = topic;
+    mqttQueuePush(topics.systemEvents.c_str(), errorDoc, MQTT_PRIORITY_SYSTEM);
+    return;
+  }
 
-      if (!errorOk)
-      {
-        Serial.println(F("MQTT publish failure report also failed"));
-      }
+  mqttQueuePush(topic, payload, priority);
+}
 
-      reportingPublishFailure = false;
-    }
-  } else {
-    Serial.println("Published to " + String(topic) + ": " + doc.as<String>());
+void mqttPublish(const char *topic, const JsonDocument &payload)
+{
+  mqttPublish(topic, payload, priorityForTopic(topic));
+}
+
+void mqttProcessQueue()
+{
+  mqttQueueProcess(sendQueuedMessage, mqttSendBudgetMs);
+}
+
+// For callers about to block or reboot: drain what can still be sent.
+// Does not call mqttClient.loop(), it may run from inside a command handler,
+// so once a pass sends nothing the link is down and waiting cannot help.
+void mqttFlushQueue(unsigned long timeoutMs)
+{
+  uint32_t start = millis();
+
+  while (mqttQueueDepth() > 0 && millis() - start < timeoutMs)
+  {
+    if (mqttQueueProcess(sendQueuedMessage, timeoutMs) == 0)
+      break;
   }
 }
 
+static void logRejectedCommand(const char *reason, const char *detail, const byte *payload, unsigned int length)
+{
+  // Bounded dump instead of echoing the whole payload byte by byte
+  Serial.printf("Command rejected: %s%s%s (%u bytes): %.*s\n", reason, detail ? " - " : "", detail ? detail : "",
+                length, (int)(length < 96 ? length : 96), (const char *)payload);
+}
+
+static void publishCommandRejected(const char *command, AdmissionResult admission)
+{
+  unsigned long suppressed = 0;
+  if (!commandAdmissionReportRejection(suppressed))
+    return;
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(5)> doc;
+  doc["action"] = "Command rejected";
+  doc["action_code"] = "command_rejected";
+  doc["command"] = command;
+  doc["reason"] = admissionResultName(admission);
+  doc["suppressed"] = suppressed;
+  mqttPublish(topics.systemEvents.c_str(), doc, MQTT_PRIORITY_SYSTEM);
+}
+
 void mqttCallback(char *topic, byte *payload, unsigned int length)
 {
-  StaticJsonDocument<256> doc;
+  if (length > commandMaxPayloadBytes)
+  {
+    commandStats.tooLarge++;
+    logRejectedCommand("payload too large", nullptr, payload, length);
+    return;
+  }
+
+  // Pass 1, read-only: copy out the command name, and the setValve state the
+  // admission check needs, leaving the buffer intact
+  StaticJsonDocument<JSON_OBJECT_SIZE(2)> headFilter;
+  headFilter["command"] = true;
+  headFilter["state"] = true;
+  StaticJsonDocument<JSON_OBJECT_SIZE(2) + 48> head;
 
-  // Deserialize the JSON
-  DeserializationError error = deserializeJson(doc, payload, length);
+  DeserializationError error = deserializeJson(head, (const char *)payload, length,
+                                               DeserializationOption::Filter(headFilter),
+                                               DeserializationOption::NestingLimit(commandMaxNesting));
   if (error)
   {
-    Serial.print("JSON parse failed: ");
-    Serial.println(error.c_str());
-    Serial.println("Payload: ");
-    for (unsigned int i = 0; i < length; i++)
-    {
-      Serial.print((char)payload[i]);
-    }
-    Serial.println();
+    commandStats.parseErrors++;
+    logRejectedCommand("JSON parse failed", error.c_str(), payload, length);
     return;
   }
 
-  if (!doc.containsKey("command"))
+  const char *name = head["command"];
+  if (!name)
   {
-    Serial.println("Missing 'command' in payload.");
-    Serial.println("Payload: ");
-    for (unsigned int i = 0; i < length; i++)
-    {
-      Serial.print((char)payload[i]);
-    }
-    Serial.println();
+    commandStats.missingCommand++;
+    logRejectedCommand("missing 'command'", nullptr, payload, length);
     return;
   }
 
-  String command = doc["command"].as<String>();
+  String command = name;
+  auto handler = commandHandlers.find(command);
+  if (handler == commandHandlers.end())
+  {
+    commandStats.unknownCommand++;
+    Serial.println("Unknown command: " + command);
+    return;
+  }
 
-  if (commandHandlers.count(command))
+  // Admission runs before the full parse, so a flood costs one small filtered pass
+  AdmissionResult admission = commandAdmit(handler->second.commandClass, head);
+  if (admission != ADMISSION_ACCEPTED)
   {
-    String jsonPayload;
-    serializeJson(doc, jsonPayload);
-    Serial.println("[Topic " + String(topic) + "] Received command: " + command + " with payload: " + jsonPayload);
-    commandHandlers[command](doc);
+    if (admission == ADMISSION_DEBOUNCED)
+      commandStats.debounced++;
+    else
+      commandStats.rateLimited++;
+    Serial.printf("Command %s rejected: %s\n", name, admissionResultName(admission));
+    publishCommandRejected(name, admission);
+    return;
   }
-  else
+
+  // Pass 2, zero-copy: strings point into PubSubClient's buffer and only the
+  // fields this handler reads are stored. Handlers must copy what they keep.
+  StaticJsonDocument<JSON_OBJECT_SIZE(commandMaxFields)> filter;
+  for (const char *const *field = handler->second.fields; *field; field++)
   {
-    Serial.println("Unknown command: " + command);
+    filter[*field] = true;
+  }
+
+  StaticJsonDocument<256> doc;
+  error = deserializeJson(doc, (char *)payload, length,
+                          DeserializationOption::Filter(filter),
+                          DeserializationOption::NestingLimit(commandMaxNesting));
+  if (error || doc.overflowed())
+  {
+    commandStats.parseErrors++;
+    Serial.printf("Command %s rejected: %s\n", name, error ? error.c_str() : "document overflow");
+    return;
   }
 
-  // String message;
-  // for (unsigned int i = 0; i < length; i++) {
-  //   message += (char)payload[i];
-  // }
-  // Serial.println("MQTT message received [" + String(topic) + "]: " + message);
-
-  // mqttPublish(topics.igro.c_str(), readSoilMoisture().c_str());
-
-  // Example: relay control via MQTT
-  //   if (String(topic) == "irrigatore/relay") {
-  //     if (message == "on") {
-  //       digitalWrite(pin_Relay, LOW); // assume active LOW
-  //     } else if (message == "off") {
-  //       digitalWrite(pin_Relay, HIGH);
-  //     }
-  //   }
+  Serial.printf("[Topic %s] Received command: %s (%u bytes, %u kept)\n", topic, command.c_str(),
+                length, (unsigned int)doc.memoryUsage());
+
+  commandStats.accepted++;
+  handler->second.run(doc);
+}
+
+bool runCommand(const String &command, const JsonDocument &doc)
+{
+  auto handler = commandHandlers.find(command);
+  if (handler == commandHandlers.end())
+    return false;
+
+  handler->second.run(doc);
+  return true;
 }
 
-void publishSystemEvent(const char *action, const char *actionCode)
+void processPendingDataRequest()
+{
+  bool force = false;
+  if (commandAdmissionTakeDataRequest(force))
+    publishSensorData(force);
+}
+
+void publishSystemEvent(const char *action, const char *actionCode, MqttPriority priority)
 {
   StaticJsonDocument<96> doc;
   doc["action"] = action;
   doc["action_code"] = actionCode;
-  mqttPublish(topics.systemEvents.c_str(), doc);
+  mqttPublish(topics.systemEvents.c_str(), doc, priority);
 }
 
 void publishSensorData(bool force)
 {
-  StaticJsonDocument<256> dataDoc;
+  StaticJsonDocument<JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE(1) +
+                     moistureTrendJsonCapacity + JSON_OBJECT_SIZE(3)> dataDoc; // igro, relay, trend, flow
   dataDoc["igro"] = readSoilMoisture(force);
   dataDoc["relay"] = readRelayState();
+  moistureTrendToJson(dataDoc.createNestedObject("trend"));
+
+  JsonObject flow = dataDoc.createNestedObject("flow");
+  flow["lpm"] = roundf(flowMeterLitersPerMinute() * 100.0f) / 100.0f;
+  flow["total_liters"] = roundf(flowMeterTotalLiters() * 100.0f) / 100.0f;
+  if (digitalRead(pinRelay) == HIGH)
+    flow["delivered_liters"] = roundf(flowMeterDeliveredLiters() * 100.0f) / 100.0f;
   mqttPublish(topics.data.c_str(), dataDoc);
 }
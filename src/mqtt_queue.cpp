@@ -0,0 +1,248 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "mqtt_queue.h"
+
+// Bounded by both slot count (mqttQueueCapacity) and payload bytes so a burst
+// of large telemetry cannot exhaust the heap while the broker is unreachable.
+const size_t mqttQueueMaxBytes = 4096;
+
+MqttQueueState mqttQueue = {};
+static MqttQueueStats stats = {0, 0, 0, 0, 0, 0};
+
+// fauxmo and HTTP callbacks run in the TCP task on ESP32, concurrently with loop()
+#if defined(ESP32)
+static portMUX_TYPE queueMux = portMUX_INITIALIZER_UNLOCKED;
+#define QUEUE_LOCK() portENTER_CRITICAL(&queueMux)
+#define QUEUE_UNLOCK() portEXIT_CRITICAL(&queueMux)
+#else
+#define QUEUE_LOCK()
+#define QUEUE_UNLOCK()
+#endif
+
+static size_t blockSize(const MqttQueuedMessage &msg)
+{
+    return msg.topicLength + 1 + msg.payloadLength + 1;
+}
+
+static char *releaseSlot(MqttQueuedMessage &msg)
+{
+    char *block = msg.block;
+    mqttQueue.bytes -= blockSize(msg);
+    mqttQueue.count--;
+    msg.block = nullptr;
+    msg.sending = false;
+    return block;
+}
+
+// Lowest priority first, oldest first within a priority; never the slot
+// being replaced
+static int findVictim(int keep)
+{
+    int victim = -1;
+    for (size_t i = 0; i < mqttQueueCapacity; i++)
+    {
+        const MqttQueuedMessage &msg = mqttQueue.slots[i];
+        if (!msg.block || msg.sending || (int)i == keep)
+            continue;
+        if (victim < 0 || msg.priority < mqttQueue.slots[victim].priority ||
+            (msg.priority == mqttQueue.slots[victim].priority && (int32_t)(msg.seq - mqttQueue.slots[victim].seq) < 0))
+            victim = i;
+    }
+    return victim;
+}
+
+// Highest priority first, oldest first within a priority
+static int findNext()
+{
+    int next = -1;
+    for (size_t i = 0; i < mqttQueueCapacity; i++)
+    {
+        const MqttQueuedMessage &msg = mqttQueue.slots[i];
+        if (!msg.block || msg.sending)
+            continue;
+        if (next < 0 || msg.priority > mqttQueue.slots[next].priority ||
+            (msg.priority == mqttQueue.slots[next].priority && (int32_t)(msg.seq - mqttQueue.slots[next].seq) < 0))
+            next = i;
+    }
+    return next;
+}
+
+static int findTelemetry(const char *topic)
+{
+    for (size_t i = 0; i < mqttQueueCapacity; i++)
+    {
+        const MqttQueuedMessage &msg = mqttQueue.slots[i];
+        if (msg.block && !msg.sending && msg.priority == MQTT_PRIORITY_TELEMETRY && strcmp(msg.block, topic) == 0)
+            return i;
+    }
+    return -1;
+}
+
+bool mqttQueuePush(const char *topic, const JsonDocument &payload, MqttPriority priority)
+{
+    size_t topicLength = strlen(topic);
+    size_t payloadLength = measureJson(payload);
+    size_t size = topicLength + 1 + payloadLength + 1;
+
+    char *block = size <= mqttQueueMaxBytes ? (char *)malloc(size) : nullptr;
+    if (!block)
+    {
+        QUEUE_LOCK();
+        stats.dropped++;
+        QUEUE_UNLOCK();
+        Serial.printf("MQTT queue: dropped message for %s (%u bytes)\n", topic, (unsigned int)size);
+        return false;
+    }
+
+    memcpy(block, topic, topicLength + 1);
+    serializeJson(payload, block + topicLength + 1, payloadLength + 1);
+
+    // Blocks are freed after unlocking: no allocator calls inside the critical section
+    char *discarded[mqttQueueCapacity + 1];
+    size_t discardedCount = 0;
+    bool accepted = true;
+
+    QUEUE_LOCK();
+    stats.enqueued++;
+
+    // A newer sensor snapshot supersedes one that has not left yet, in place;
+    // it can be larger, so it goes through the same caps as a new message
+    int existing = priority == MQTT_PRIORITY_TELEMETRY ? findTelemetry(topic) : -1;
+    size_t replacedSize = existing >= 0 ? blockSize(mqttQueue.slots[existing]) : 0;
+    size_t slotsNeeded = existing >= 0 ? 0 : 1;
+
+    while (mqttQueue.count + slotsNeeded > mqttQueueCapacity ||
+           mqttQueue.bytes - replacedSize + size > mqttQueueMaxBytes)
+    {
+        int victim = findVictim(existing);
+        if (victim < 0 || mqttQueue.slots[victim].priority > priority)
+        {
+            accepted = false;
+            break;
+        }
+        discarded[discardedCount++] = releaseSlot(mqttQueue.slots[victim]);
+        stats.dropped++;
+    }
+
+    if (!accepted)
+    {
+        discarded[discardedCount++] = block;
+        stats.dropped++;
+    }
+    else if (existing >= 0)
+    {
+        MqttQueuedMessage &msg = mqttQueue.slots[existing];
+        mqttQueue.bytes = mqttQueue.bytes - replacedSize + size;
+        discarded[discardedCount++] = msg.block;
+        msg.block = block;
+        msg.payloadLength = payloadLength;
+        msg.enqueuedAt = millis();
+        stats.coalesced++;
+    }
+    else
+    {
+        for (size_t i = 0; i < mqttQueueCapacity; i++)
+        {
+            if (mqttQueue.slots[i].block)
+                continue;
+            mqttQueue.slots[i] = {block, (uint16_t)topicLength, (uint16_t)payloadLength, priority, false, millis(), mqttQueue.nextSeq++};
+            mqttQueue.count++;
+            mqttQueue.bytes += size;
+            break;
+        }
+        if (mqttQueue.count > stats.highWater)
+            stats.highWater = mqttQueue.count;
+    }
+    QUEUE_UNLOCK();
+
+    for (size_t i = 0; i < discardedCount; i++)
+        free(discarded[i]);
+
+    if (!accepted)
+        Serial.printf("MQTT queue full: dropped message for %s\n", topic);
+    return accepted;
+}
+
+size_t mqttQueueProcess(MqttQueueSender sender, unsigned long budgetMs)
+{
+    size_t processed = 0;
+    uint32_t start = millis();
+
+    // At least one message per call, even with a zero budget
+    do
+    {
+        QUEUE_LOCK();
+        int next = findNext();
+        MqttQueuedMessage msg = {};
+        if (next >= 0)
+        {
+            mqttQueue.slots[next].sending = true;
+            msg = mqttQueue.slots[next];
+        }
+        QUEUE_UNLOCK();
+
+        if (next < 0)
+            break;
+
+        MqttSendResult result = sender(msg.block, msg.block + msg.topicLength + 1, msg.payloadLength, millis() - msg.enqueuedAt);
+
+        char *block = nullptr;
+        QUEUE_LOCK();
+        if (result == MQTT_SEND_RETRY)
+        {
+            mqttQueue.slots[next].sending = false;
+            stats.retries++;
+        }
+        else
+        {
+            block = releaseSlot(mqttQueue.slots[next]);
+            if (result == MQTT_SEND_OK)
+                stats.sent++;
+            else
+                stats.dropped++;
+        }
+        QUEUE_UNLOCK();
+
+        if (result == MQTT_SEND_RETRY)
+            break;
+
+        free(block);
+        processed++;
+    } while (millis() - start < budgetMs);
+
+    return processed;
+}
+
+void mqttQueueClear()
+{
+    char *discarded[mqttQueueCapacity];
+    size_t discardedCount = 0;
+
+    QUEUE_LOCK();
+    for (size_t i = 0; i < mqttQueueCapacity; i++)
+    {
+        if (!mqttQueue.slots[i].block || mqttQueue.slots[i].sending)
+            continue;
+        discarded[discardedCount++] = releaseSlot(mqttQueue.slots[i]);
+        stats.dropped++;
+    }
+    QUEUE_UNLOCK();
+
+    for (size_t i = 0; i < discardedCount; i++)
+        free(discarded[i]);
+}
+
+size_t mqttQueueDepth()
+{
+    return mqttQueue.count;
+}
+
+size_t mqttQueueBytes()
+{
+    return mqttQueue.bytes;
+}
+
+const MqttQueueStats &mqttQueueStats()
+{
+    return stats;
+}
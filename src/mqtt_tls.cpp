@@ -0,0 +1,195 @@
+#if defined(MQTT_USE_TLS)
+#include <Arduino.h>
+#include "mqtt_tls.h"
+#include "globals.h"
+
+#if defined(ESP8266)
+// Session parameters survive ESP.restart() and deep sleep in RTC user memory
+struct TlsSessionCache
+{
+    uint32_t magic;
+    uint32_t checksum;
+    BearSSL::Session session;
+};
+
+static_assert(sizeof(TlsSessionCache) % 4 == 0, "RTC memory is written in 4-byte blocks");
+static_assert(sizeof(TlsSessionCache) <= 512, "RTC user memory is 512 bytes");
+
+const uint32_t tlsSessionCacheMagic = 0x534B5431; // "SKT1"
+const uint32_t tlsSessionRtcOffset = 0;           // in 4-byte blocks
+const unsigned long tlsMinValidEpoch = 1577836800UL; // 2020-01-01; before NTP sync the clock starts at 1970
+
+enum MflnSupport : uint8_t
+{
+    MFLN_UNKNOWN,    // not probed, or the probe got no answer
+    MFLN_SUPPORTED,
+    MFLN_UNSUPPORTED // probe failed right before a connect that worked
+};
+
+static BearSSL::Session tlsSession;
+static BearSSL::Session sessionBeforeConnect;
+static BearSSL::X509List *trustAnchors = nullptr;
+static const char *brokerHost = nullptr;
+static uint16_t brokerPort = 0;
+static MflnSupport mflnSupport = MFLN_UNKNOWN;
+
+static uint32_t sessionChecksum(const BearSSL::Session &session)
+{
+    const uint8_t *bytes = (const uint8_t *)&session;
+    uint32_t hash = 2166136261UL; // FNV-1a
+    for (size_t i = 0; i < sizeof(session); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+static bool sessionIsEmpty(const BearSSL::Session &session)
+{
+    const uint8_t *bytes = (const uint8_t *)&session;
+    for (size_t i = 0; i < sizeof(session); i++)
+    {
+        if (bytes[i])
+            return false;
+    }
+    return true;
+}
+
+static void loadSessionCache()
+{
+    TlsSessionCache cache;
+    if (!ESP.rtcUserMemoryRead(tlsSessionRtcOffset, (uint32_t *)&cache, sizeof(cache)))
+        return;
+
+    if (cache.magic != tlsSessionCacheMagic || cache.checksum != sessionChecksum(cache.session))
+    {
+        Serial.println("[TLS] No cached session in RTC memory");
+        return;
+    }
+
+    memcpy(&tlsSession, &cache.session, sizeof(tlsSession));
+    Serial.println("[TLS] Restored cached session from RTC memory");
+}
+
+static void storeSessionCache()
+{
+    TlsSessionCache cache;
+    cache.magic = tlsSessionCacheMagic;
+    memcpy(&cache.session, &tlsSession, sizeof(tlsSession));
+    cache.checksum = sessionChecksum(cache.session);
+    ESP.rtcUserMemoryWrite(tlsSessionRtcOffset, (uint32_t *)&cache, sizeof(cache));
+}
+
+void mqttTlsSetup(const char *host, uint16_t port, const char *caCert, const char *fingerprint)
+{
+    if (caCert)
+    {
+        trustAnchors = new BearSSL::X509List(caCert);
+        espClient.setTrustAnchors(trustAnchors);
+    }
+    else if (fingerprint)
+    {
+        espClient.setFingerprint(fingerprint);
+    }
+    else
+    {
+        Serial.println("[TLS] WARNING: no CA or fingerprint configured, broker is not verified");
+        espClient.setInsecure();
+    }
+
+    brokerHost = host;
+    brokerPort = port;
+    espClient.setBufferSizes(16384, 512);
+
+    loadSessionCache();
+    espClient.setSession(&tlsSession);
+}
+
+bool mqttTlsBeforeConnect()
+{
+    // Certificate validity is checked against this clock. Before the first
+    // NTP sync every certificate would look not yet valid, so wait for it.
+    if (trustAnchors)
+    {
+        unsigned long now = GetEpochTime();
+        if (now < tlsMinValidEpoch)
+        {
+            Serial.println("[TLS] Clock not set yet, connect deferred");
+            return false;
+        }
+        espClient.setX509Time(now);
+    }
+
+    // Shrink the 16k receive buffer when the broker supports max fragment
+    // length. A failed probe may only mean the broker was unreachable, so it
+    // is repeated on every attempt until a connect shows the broker was up.
+    if (mflnSupport == MFLN_UNKNOWN && espClient.probeMaxFragmentLength(brokerHost, brokerPort, 1024))
+    {
+        mflnSupport = MFLN_SUPPORTED;
+        espClient.setBufferSizes(1024, 512);
+        Serial.println("[TLS] Broker supports MFLN, using 1k buffers");
+    }
+
+    memcpy(&sessionBeforeConnect, &tlsSession, sizeof(tlsSession));
+    return true;
+}
+
+bool mqttTlsAfterConnect(bool connected)
+{
+    if (!connected)
+        return false;
+
+    if (mflnSupport == MFLN_UNKNOWN)
+        mflnSupport = MFLN_UNSUPPORTED;
+
+    // The library updates tlsSession on every handshake; identical parameters mean resumption
+    bool resumed = !sessionIsEmpty(sessionBeforeConnect) &&
+                   memcmp(&sessionBeforeConnect, &tlsSession, sizeof(tlsSession)) == 0;
+    if (!resumed)
+        storeSessionCache();
+
+    return resumed;
+}
+#elif defined(ESP32)
+// The Arduino ESP32 client does not expose mbedTLS sessions: TLS with a
+// pinned CA, but every connection is a full handshake. It cannot pin a
+// fingerprint before the credentials go out, so a fingerprint-only build
+// refuses to connect instead of falling back to an unverified link.
+static bool fingerprintOnly = false;
+
+void mqttTlsSetup(const char *host, uint16_t port, const char *caCert, const char *fingerprint)
+{
+    if (caCert)
+    {
+        espClient.setCACert(caCert);
+        if (fingerprint)
+            Serial.println("[TLS] WARNING: fingerprint pinning is not supported on ESP32, verifying against the CA only");
+    }
+    else if (fingerprint)
+    {
+        fingerprintOnly = true;
+    }
+    else
+    {
+        Serial.println("[TLS] WARNING: no CA configured, broker is not verified");
+        espClient.setInsecure();
+    }
+    espClient.setHandshakeTimeout(10);
+}
+
+bool mqttTlsBeforeConnect()
+{
+    if (fingerprintOnly)
+    {
+        Serial.println("[TLS] ERROR: fingerprint pinning is not supported on ESP32, set MQTT_CA_CERT");
+        return false;
+    }
+    return true; // certificate dates are not checked by the ESP32 mbedTLS build
+}
+
+bool mqttTlsAfterConnect(bool connected)
+{
+    return false;
+}
+#endif
+#endif
@@ -0,0 +1,152 @@
+#if defined(SMARTKLER_GATEWAY) && (defined(ESP8266) || defined(ESP32))
+
+#include <Arduino.h>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <espnow.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#include <esp_now.h>
+#if __has_include(<esp_idf_version.h>)
+#include <esp_idf_version.h>
+#endif
+#endif
+#include "node_link.h"
+
+// Filled from the WiFi task, drained by loop(); one slot always stays empty
+const size_t espNowRxSlots = 16;
+
+static NodePacket rxRing[espNowRxSlots];
+static volatile size_t rxHead = 0;
+static volatile size_t rxTail = 0;
+static volatile unsigned long rxOverflows = 0;
+
+#if defined(ESP32)
+static portMUX_TYPE rxMux = portMUX_INITIALIZER_UNLOCKED;
+#define RX_LOCK() portENTER_CRITICAL(&rxMux)
+#define RX_UNLOCK() portEXIT_CRITICAL(&rxMux)
+#else
+#define RX_LOCK()
+#define RX_UNLOCK()
+#endif
+
+static void storeFrame(const uint8_t *mac, const uint8_t *data, int len, int8_t rssi)
+{
+  if (len <= 0 || (size_t)len > nodeMaxFrameBytes)
+    return;
+
+  RX_LOCK();
+  size_t next = (rxHead + 1) % espNowRxSlots;
+  if (next == rxTail)
+  {
+    rxOverflows++;
+  }
+  else
+  {
+    NodePacket &packet = rxRing[rxHead];
+    memcpy(packet.from.mac, mac, sizeof(packet.from.mac));
+    packet.rssi = rssi;
+    packet.length = (uint8_t)len;
+    memcpy(packet.data, data, len);
+    rxHead = next;
+  }
+  RX_UNLOCK();
+}
+
+// Only the IDF 5 callback (arduino-esp32 3.x) carries the RX metadata; the
+// ESP8266 SDK and older ESP32 cores give no RSSI, so it is left at 0 there
+// and the batch omits the field.
+#if defined(ESP8266)
+static void onEspNowReceive(uint8_t *mac, uint8_t *data, uint8_t len)
+{
+  storeFrame(mac, data, len, 0);
+}
+#elif defined(ESP32) && defined(ESP_IDF_VERSION_MAJOR) && ESP_IDF_VERSION_MAJOR >= 5
+static void onEspNowReceive(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+  storeFrame(info->src_addr, data, len, info->rx_ctrl ? (int8_t)info->rx_ctrl->rssi : 0);
+}
+#elif defined(ESP32)
+static void onEspNowReceive(const uint8_t *mac, const uint8_t *data, int len)
+{
+  storeFrame(mac, data, len, 0);
+}
+#endif
+
+bool EspNowLink::begin()
+{
+#if defined(ESP8266)
+  if (esp_now_init() != 0)
+    return false;
+  esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+  esp_now_register_recv_cb(onEspNowReceive);
+#elif defined(ESP32)
+  if (esp_now_init() != ESP_OK)
+    return false;
+  esp_now_register_recv_cb(onEspNowReceive);
+#endif
+  Serial.printf("ESP-NOW ready on channel %d\n", WiFi.channel());
+  return true;
+}
+
+// Peers are registered on first use; channel 0 follows the station channel
+static bool ensurePeer(const NodeAddress &to)
+{
+#if defined(ESP8266)
+  uint8_t *mac = const_cast<uint8_t *>(to.mac);
+  if (esp_now_is_peer_exist(mac) > 0)
+    return true;
+  return esp_now_add_peer(mac, ESP_NOW_ROLE_COMBO, 0, nullptr, 0) == 0;
+#elif defined(ESP32)
+  if (esp_now_is_peer_exist(to.mac))
+    return true;
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, to.mac, sizeof(to.mac));
+  peer.channel = 0;
+  peer.ifidx = WIFI_IF_STA;
+  peer.encrypt = false;
+  return esp_now_add_peer(&peer) == ESP_OK;
+#endif
+}
+
+bool EspNowLink::send(const NodeAddress &to, const uint8_t *data, size_t length)
+{
+  if (!ensurePeer(to))
+    return false;
+#if defined(ESP8266)
+  return esp_now_send(const_cast<uint8_t *>(to.mac), const_cast<uint8_t *>(data), length) == 0;
+#elif defined(ESP32)
+  return esp_now_send(to.mac, data, length) == ESP_OK;
+#endif
+}
+
+// The peer table is smaller than the set of nodes that may come and go
+void EspNowLink::forget(const NodeAddress &address)
+{
+#if defined(ESP8266)
+  uint8_t *mac = const_cast<uint8_t *>(address.mac);
+  if (esp_now_is_peer_exist(mac) > 0)
+    esp_now_del_peer(mac);
+#elif defined(ESP32)
+  if (esp_now_is_peer_exist(address.mac))
+    esp_now_del_peer(address.mac);
+#endif
+}
+
+bool EspNowLink::receive(NodePacket &packet)
+{
+  bool available = false;
+
+  RX_LOCK();
+  if (rxTail != rxHead)
+  {
+    packet = rxRing[rxTail];
+    rxTail = (rxTail + 1) % espNowRxSlots;
+    available = true;
+  }
+  RX_UNLOCK();
+
+  return available;
+}
+
+#endif
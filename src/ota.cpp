@@ -0,0 +1,451 @@
+#include <Arduino.h>
+#include <ArduinoOTA.h>
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESP8266httpUpdate.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <Update.h>
+#include <MD5Builder.h>
+#include "esp32/rom/crc.h"
+#include "esp32/rom/miniz.h"
+#endif
+#include <ArduinoJson.h>
+#include "ota.h"
+#include "globals.h"
+#include "mqtt.h"
+#include "sensors.h"
+
+// Progress goes to MQTT only every otaProgressStepPercent, the final event
+// carries size, duration, throughput and outcome. Gzip images are handled
+// natively by the ESP8266 updater and inflated on the fly on ESP32 (pull only).
+// Pulls need Content-Length and the MD5 of the file as served; ESP32 also
+// checks the gzip trailer (CRC32 and size of the inflated image).
+
+const unsigned int otaProgressStepPercent = 10;
+const unsigned long otaPullTimeoutMs = 15000;
+const unsigned long otaEventFlushMs = 1000;
+
+struct OtaSession
+{
+    const char *source;
+    uint32_t startMs;
+    size_t bytes;
+    size_t total;
+    unsigned int lastStep;
+    bool compressed;
+};
+
+static OtaSession session;
+
+static String pendingPullUrl;
+static String pendingPullMd5;
+static uint32_t pendingPullDueTime = 0;
+static bool pullPending = false;
+
+// Shared by espota and HTTP pulls
+static void otaBegin(const char *source)
+{
+    session = {source, millis(), 0, 0, 0, false};
+
+    // Never flash with the valve open: the reboot would leave it unattended
+    if (digitalRead(pinRelay) == HIGH)
+    {
+        setRelayState(false);
+    }
+
+    StaticJsonDocument<128> doc;
+    doc["action"] = "OTA Update Started";
+    doc["action_code"] = "ota_start";
+    doc["source"] = source;
+    mqttPublish(topics.systemEvents.c_str(), doc);
+    mqttFlushQueue(otaEventFlushMs);
+    Serial.printf("OTA Start (%s)\n", source);
+}
+
+static void otaProgress(size_t progress, size_t total)
+{
+    session.bytes = progress;
+    session.total = total;
+
+    if (total == 0)
+        return;
+
+    unsigned int percent = (unsigned int)((uint64_t)progress * 100 / total);
+    unsigned int step = percent / otaProgressStepPercent * otaProgressStepPercent;
+
+    if (step <= session.lastStep || percent >= 100)
+        return;
+
+    session.lastStep = step;
+    Serial.printf("OTA Progress: %u%%\n", step);
+
+    StaticJsonDocument<96> doc;
+    doc["action_code"] = "ota_progress";
+    doc["percent"] = step;
+    doc["bytes"] = progress;
+    mqttPublish(topics.systemEvents.c_str(), doc);
+    // loop() does not run during a transfer: send it now
+    mqttFlushQueue(otaEventFlushMs);
+}
+
+static void otaFinish(bool ok, const char *error)
+{
+    uint32_t durationMs = millis() - session.startMs;
+    float throughputKBps = durationMs > 0 ? (session.bytes / 1024.0f) / (durationMs / 1000.0f) : 0.0f;
+
+    StaticJsonDocument<256> doc;
+    doc["action"] = ok ? "OTA Update Completed" : "OTA Update Failed";
+    doc["action_code"] = ok ? "ota_end" : "ota_failed";
+    doc["source"] = session.source;
+    doc["outcome"] = ok ? "success" : "error";
+    if (error)
+        doc["error"] = error;
+    doc["bytes"] = session.bytes;
+    doc["duration_ms"] = durationMs;
+    doc["throughput_kBps"] = roundf(throughputKBps * 10.0f) / 10.0f;
+    if (strcmp(session.source, "http") == 0)
+        doc["compressed"] = session.compressed;
+    mqttPublish(topics.systemEvents.c_str(), doc);
+    mqttFlushQueue(otaEventFlushMs);
+
+    Serial.printf("OTA %s: %u bytes in %lu ms (%.1f kB/s)%s%s\n", ok ? "End" : "Error",
+                  (unsigned int)session.bytes, (unsigned long)durationMs, throughputKBps,
+                  error ? " - " : "", error ? error : "");
+}
+
+static const char *otaErrorName(ota_error_t error)
+{
+    switch (error)
+    {
+    case OTA_AUTH_ERROR:
+        return "auth_failed";
+    case OTA_BEGIN_ERROR:
+        return "begin_failed";
+    case OTA_CONNECT_ERROR:
+        return "connect_failed";
+    case OTA_RECEIVE_ERROR:
+        return "receive_failed";
+    case OTA_END_ERROR:
+        return "end_failed";
+    default:
+        return "unknown";
+    }
+}
+
+void OTASetup() {
+    ArduinoOTA.setHostname(("smartkler-" + deviceID).c_str());
+    ArduinoOTA.onStart([]()
+    { 
+        otaBegin("espota");
+    });
+
+    ArduinoOTA.onEnd([]() {
+        otaFinish(true, nullptr);
+    });
+
+    ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+        otaProgress(progress, total);
+    });
+
+    ArduinoOTA.onError([](ota_error_t error) {
+        otaFinish(false, otaErrorName(error));
+    });
+
+    ArduinoOTA.begin();
+}
+
+#if defined(ESP32)
+// The download as served: its length, MD5 and last 8 bytes, which hold the
+// gzip trailer once the whole file has arrived
+struct PullStream
+{
+    HTTPClient *http;
+    WiFiClient *client;
+    size_t total;
+    size_t received;
+    bool hashRaw;
+    MD5Builder md5;
+    uint8_t tail[8];
+};
+
+static void recordChunk(PullStream &pull, uint8_t *buffer, size_t len)
+{
+    if (pull.hashRaw)
+        pull.md5.add(buffer, (uint16_t)len);
+
+    size_t keep = sizeof(pull.tail);
+    if (len >= keep)
+    {
+        memcpy(pull.tail, buffer + len - keep, keep);
+    }
+    else
+    {
+        memmove(pull.tail, pull.tail + len, keep - len);
+        memcpy(pull.tail + keep - len, buffer, len);
+    }
+
+    pull.received += len;
+    otaProgress(pull.received, pull.total);
+}
+
+// Reads at most up to Content-Length; 0 at the end, on close or on timeout
+static size_t readChunk(PullStream &pull, uint8_t *buffer, size_t capacity)
+{
+    if (pull.received >= pull.total)
+        return 0;
+    if (capacity > pull.total - pull.received)
+        capacity = pull.total - pull.received;
+
+    uint32_t start = millis();
+
+    while (millis() - start < otaPullTimeoutMs)
+    {
+        size_t available = pull.client->available();
+        if (available > 0)
+        {
+            size_t len = pull.client->readBytes(buffer, available < capacity ? available : capacity);
+            recordChunk(pull, buffer, len);
+            return len;
+        }
+        if (!pull.http->connected())
+            return 0;
+        delay(1);
+    }
+
+    return 0;
+}
+
+// Returns the gzip header length, 0 if incomplete or not gzip/deflate
+static size_t gzipHeaderLength(const uint8_t *buf, size_t len)
+{
+    if (len < 10 || buf[0] != 0x1f || buf[1] != 0x8b || buf[2] != 8)
+        return 0;
+
+    uint8_t flags = buf[3];
+    size_t pos = 10;
+
+    if (flags & 0x04) // FEXTRA
+    {
+        if (pos + 2 > len)
+            return 0;
+        pos += 2 + (buf[pos] | (buf[pos + 1] << 8));
+    }
+    for (uint8_t field = 0x08; field <= 0x10; field <<= 1) // FNAME, FCOMMENT
+    {
+        if (!(flags & field))
+            continue;
+        while (pos < len && buf[pos] != 0)
+            pos++;
+        pos++;
+    }
+    if (flags & 0x02) // FHCRC
+        pos += 2;
+
+    return pos <= len ? pos : 0;
+}
+
+static uint32_t readLe32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const char *writeGzipImage(PullStream &pull, uint8_t *in, size_t inCapacity, size_t inLen)
+{
+    size_t inPos = gzipHeaderLength(in, inLen);
+    if (inPos == 0)
+        return "bad_gzip_header";
+
+    tinfl_decompressor *inflator = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+    uint8_t *dict = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE);
+    if (!inflator || !dict)
+    {
+        free(inflator);
+        free(dict);
+        return "out_of_memory";
+    }
+
+    const char *error = nullptr;
+    size_t dictPos = 0;
+    uint32_t crc = 0;
+    uint32_t inflated = 0;
+    tinfl_init(inflator);
+
+    while (!error)
+    {
+        size_t inBytes = inLen - inPos;
+        size_t outBytes = TINFL_LZ_DICT_SIZE - dictPos;
+        tinfl_status status = tinfl_decompress(inflator, in + inPos, &inBytes, dict, dict + dictPos,
+                                               &outBytes, TINFL_FLAG_HAS_MORE_INPUT);
+        inPos += inBytes;
+
+        if (outBytes > 0 && Update.write(dict + dictPos, outBytes) != outBytes)
+            error = "write_failed";
+        crc = crc32_le(crc, dict + dictPos, outBytes);
+        inflated += outBytes;
+        dictPos = (dictPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+        if (status == TINFL_STATUS_DONE)
+            break;
+        if (status < TINFL_STATUS_DONE)
+            error = "inflate_failed";
+        else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && inPos == inLen)
+        {
+            inLen = readChunk(pull, in, inCapacity);
+            inPos = 0;
+            if (inLen == 0)
+                error = "truncated";
+        }
+    }
+
+    free(inflator);
+    free(dict);
+
+    // tinfl may have buffered past the deflate data, so the trailer is taken
+    // from the end of the file rather than from the decoder's position
+    while (!error && pull.received < pull.total)
+    {
+        if (readChunk(pull, in, inCapacity) == 0)
+            error = "truncated";
+    }
+    if (!error && (readLe32(pull.tail) != crc || readLe32(pull.tail + 4) != inflated))
+        error = "gzip_crc_mismatch";
+
+    return error;
+}
+
+static const char *pullUpdate(const String &url, const String &md5)
+{
+    WiFiClient client;
+    HTTPClient http;
+    http.setTimeout(otaPullTimeoutMs);
+    http.useHTTP10(true); // no chunked transfer encoding mixed into the image
+
+    if (!http.begin(client, url))
+        return "bad_url";
+
+    int code = http.GET();
+    if (code != HTTP_CODE_OK)
+    {
+        http.end();
+        return "http_error";
+    }
+
+    int total = http.getSize();
+    if (total <= 0)
+    {
+        http.end();
+        return "no_content_length";
+    }
+
+    PullStream pull;
+    pull.http = &http;
+    pull.client = http.getStreamPtr();
+    pull.total = (size_t)total;
+    pull.received = 0;
+    pull.hashRaw = true;
+    pull.md5.begin();
+    memset(pull.tail, 0, sizeof(pull.tail));
+
+    uint8_t buffer[1024];
+    size_t len = readChunk(pull, buffer, sizeof(buffer));
+    session.compressed = len >= 2 && buffer[0] == 0x1f && buffer[1] == 0x8b;
+
+    // md5 is of the file as served. Update.setMD5() hashes what is written,
+    // which for gzip is the inflated image, so those are hashed on arrival.
+    pull.hashRaw = session.compressed;
+
+    const char *error = nullptr;
+    if (!Update.begin(session.compressed ? UPDATE_SIZE_UNKNOWN : pull.total))
+        error = "begin_failed";
+    else if (session.compressed)
+    {
+        error = writeGzipImage(pull, buffer, sizeof(buffer), len);
+        if (!error)
+        {
+            pull.md5.calculate();
+            if (!pull.md5.toString().equalsIgnoreCase(md5))
+                error = "md5_mismatch";
+        }
+    }
+    else if (!Update.setMD5(md5.c_str()))
+        error = "bad_md5";
+    else
+    {
+        while (len > 0 && !error)
+        {
+            if (Update.write(buffer, len) != len)
+                error = "write_failed";
+            len = readChunk(pull, buffer, sizeof(buffer));
+        }
+        if (!error && pull.received < pull.total)
+            error = "truncated";
+    }
+
+    if (!error && !Update.end(true))
+        error = Update.getError() == UPDATE_ERROR_MD5 ? "md5_mismatch" : "end_failed";
+    else if (error)
+        Update.abort();
+
+    http.end();
+    return error;
+}
+#elif defined(ESP8266)
+static const char *pullUpdate(const String &url, const String &md5)
+{
+    WiFiClient client;
+
+    // The ESP8266 updater recognises gzip images on its own and hashes the
+    // bytes it writes, which are the file as served. It already asks for
+    // HTTP/1.0 and refuses responses without Content-Length.
+    ESPhttpUpdate.rebootOnUpdate(false);
+    ESPhttpUpdate.setMD5sum(md5);
+    ESPhttpUpdate.onProgress([](int progress, int total) {
+        otaProgress(progress, total);
+    });
+
+    t_httpUpdate_return result = ESPhttpUpdate.update(client, url);
+    session.compressed = url.endsWith(".gz"); // the updater does not expose what it detected
+
+    if (result == HTTP_UPDATE_OK)
+        return nullptr;
+
+    Serial.println("HTTP update error: " + ESPhttpUpdate.getLastErrorString());
+    if (result == HTTP_UPDATE_NO_UPDATES)
+        return "no_updates";
+    return ESPhttpUpdate.getLastError() == UPDATE_ERROR_MD5 ? "md5_mismatch" : "http_update_failed";
+}
+#endif
+
+void scheduleOtaPull(const String &url, const String &md5, unsigned long jitterSeconds)
+{
+    // Random delay spreads a fleet-wide rollout over the local server
+    pendingPullUrl = url;
+    pendingPullMd5 = md5;
+    pendingPullDueTime = millis() + (jitterSeconds > 0 ? (unsigned long)random(jitterSeconds * 1000UL) : 0);
+    pullPending = true;
+
+    Serial.printf("OTA pull scheduled in %lu ms: %s\n", (unsigned long)(pendingPullDueTime - millis()), url.c_str());
+}
+
+void otaLoop()
+{
+    if (!pullPending)
+        return;
+
+    if ((int32_t)(millis() - pendingPullDueTime) < 0)
+        return;
+
+    pullPending = false;
+
+    otaBegin("http");
+    const char *error = pullUpdate(pendingPullUrl, pendingPullMd5);
+    otaFinish(error == nullptr, error);
+
+    if (!error)
+    {
+        delay(500); // let the final event leave the socket
+        ESP.restart();
+    }
+}
@@ -2,14 +2,16 @@
 #include "sensors.h"
 #include "globals.h"
 #include "mqtt.h"
+#include "moisture_trend.h"
+#include "flow_meter.h"
 
 const unsigned long sensorPublishAfterRelayDelayMs = 750;
 bool sensorPublishPending = false;
-unsigned long sensorPublishDueTime = 0;
+uint32_t sensorPublishDueTime = 0;
 
-StaticJsonDocument<128>& readSoilMoisture(bool forceRead = false)
+SoilReadingDoc& readSoilMoisture(bool forceRead = false)
 {
-    unsigned long now = millis();
+    uint32_t now = millis();
 
     if (!forceRead && (now - lastMoistureReadTime < soilReadsIntervalMs))
     {
@@ -32,7 +34,7 @@ StaticJsonDocument<128>& readSoilMoisture(bool forceRead = false)
     Serial.print(percent);
     Serial.println();
 
-    static StaticJsonDocument<128> doc;
+    static SoilReadingDoc doc;
     doc["raw"] = raw;
     doc["percent"] = percent;
     doc["timestamp"] = now;
@@ -41,15 +43,16 @@ StaticJsonDocument<128>& readSoilMoisture(bool forceRead = false)
 
     lastMoistureData = doc;
     lastMoistureReadTime = now;
+    moistureTrendAddSample(raw, now);
 
     return doc;
 }
 
-StaticJsonDocument<64>& readRelayState()
+RelayStateDoc& readRelayState()
 {
     int state = digitalRead(pinRelay);
 
-    static StaticJsonDocument<64> doc;
+    static RelayStateDoc doc;
     doc["relay_state"] = state; // 0 = closed, 1 = opened (logical)
 
     return doc;
@@ -63,14 +66,19 @@ int setRelayState(bool state)
     if (state)
     {
         Serial.println("Valve turned ON (watchdog started)");
+        flowMeterMarkValveOpen();
         msg["command_result"] = "valve_on";
         msg["message"] = "Valvola aperta";
+        if (valveTargetLiters > 0)
+            msg["target_liters"] = valveTargetLiters;
     }
     else
     {
         Serial.println("Valve turned OFF");
         msg["command_result"] = "valve_off";
         msg["message"] = "Valvola chiusa";
+        msg["delivered_liters"] = roundf(flowMeterDeliveredLiters() * 100.0f) / 100.0f;
+        msg["flow_lpm"] = roundf(flowMeterLitersPerMinute() * 100.0f) / 100.0f;
     }
     
     mqttPublish(topics.valve.c_str(), msg);
@@ -86,7 +94,7 @@ void processDeferredSensorPublish()
     if (!sensorPublishPending)
         return;
 
-    if ((long)(millis() - sensorPublishDueTime) < 0)
+    if ((int32_t)(millis() - sensorPublishDueTime) < 0)
         return;
 
     sensorPublishPending = false;
@@ -100,7 +108,7 @@ void checkValveWatchdog()
     if (!relayState)
         return; // No need to check if valve is off
 
-    unsigned long now = millis();
+    uint32_t now = millis();
     bool shouldStop = false;
     String reason;
     
@@ -111,6 +119,13 @@ void checkValveWatchdog()
         reason = "Regular time expired";
     }
 
+    // 2. Dosed volume reached (time limits stay as a backstop)
+    if (valveTargetLiters > 0 && flowMeterDeliveredLiters() >= valveTargetLiters)
+    {
+        shouldStop = true;
+        reason = "Volume target reached";
+    }
+
     if (now - lastValveStartTime > valveSecurityStop)
     {
         shouldStop = true;
@@ -121,6 +136,6 @@ void checkValveWatchdog()
     {
         Serial.printf("[VALVE] Auto-off triggered: reason = %s\n", reason.c_str());
         setRelayState(false);
-        publishSystemEvent("Valve Auto-Off", reason.c_str());
+        publishSystemEvent("Valve Auto-Off", reason.c_str(), MQTT_PRIORITY_SAFETY);
     }
 }
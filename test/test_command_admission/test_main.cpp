@@ -0,0 +1,223 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "host_hal.h"
+#include "globals.h"
+#include "mqtt.h"
+#include "command_admission.h"
+
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+
+void initMQTThandlers();
+
+static std::vector<std::string> events;
+
+static MqttSendResult recordingSender(const char *topic, const char *payload, size_t length, unsigned long ageMs)
+{
+    if (topics.systemEvents == topic)
+        events.push_back(std::string(payload, length));
+    return MQTT_SEND_OK;
+}
+
+static AdmissionResult admit(CommandClass commandClass, const char *state = nullptr)
+{
+    StaticJsonDocument<JSON_OBJECT_SIZE(1)> doc;
+    if (state)
+        doc["state"] = state;
+    return commandAdmit(commandClass, doc);
+}
+
+static void deliver(const char *json)
+{
+    std::string payload(json);
+    mqttCallback((char *)"t/commands", (byte *)&payload[0], payload.size());
+}
+
+static size_t countEvents(const char *actionCode)
+{
+    size_t count = 0;
+    for (const std::string &event : events)
+    {
+        DynamicJsonDocument doc(1024);
+        if (!deserializeJson(doc, event) && strcmp(doc["action_code"] | "", actionCode) == 0)
+            count++;
+    }
+    return count;
+}
+
+void setUp(void)
+{
+    // Start well clear of zero, a zero lastDataRequestServed means never served
+    host::setTimeMs(1000000);
+    host::resetPins();
+    commandAdmission = {};
+    commandStats = {};
+    topics.systemEvents = "t/events";
+    mqttQueueClear();
+    events.clear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_query_bucket_bursts_then_refills(void)
+{
+    for (int i = 0; i < 10; i++)
+        TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_QUERY));
+    TEST_ASSERT_EQUAL(ADMISSION_RATE_LIMITED, admit(COMMAND_CLASS_QUERY));
+
+    host::advanceTime(199);
+    TEST_ASSERT_EQUAL(ADMISSION_RATE_LIMITED, admit(COMMAND_CLASS_QUERY));
+    host::advanceTime(1);
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_QUERY));
+    TEST_ASSERT_EQUAL(ADMISSION_RATE_LIMITED, admit(COMMAND_CLASS_QUERY));
+
+    // A long pause refills to the burst size, not beyond
+    host::advanceTime(60000);
+    for (int i = 0; i < 10; i++)
+        TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_QUERY));
+    TEST_ASSERT_EQUAL(ADMISSION_RATE_LIMITED, admit(COMMAND_CLASS_QUERY));
+}
+
+void test_buckets_are_per_class(void)
+{
+    for (int i = 0; i < 2; i++)
+        TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_SYSTEM));
+    TEST_ASSERT_EQUAL(ADMISSION_RATE_LIMITED, admit(COMMAND_CLASS_SYSTEM));
+
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_QUERY));
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_CONFIG));
+
+    host::advanceTime(60000);
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_SYSTEM));
+}
+
+void test_valve_off_is_never_rate_limited(void)
+{
+    // Relay stays low, so repeated "on" is not debounced and spends tokens
+    for (int i = 0; i < 5; i++)
+        TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_VALVE, "on"));
+    TEST_ASSERT_EQUAL(ADMISSION_RATE_LIMITED, admit(COMMAND_CLASS_VALVE, "on"));
+
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_VALVE, "OFF"));
+    host::advanceTime(2000);
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_VALVE, "on"));
+}
+
+void test_repeated_valve_state_is_debounced(void)
+{
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_VALVE, "on"));
+    digitalWrite(pinRelay, HIGH);
+
+    host::advanceTime(2999);
+    TEST_ASSERT_EQUAL(ADMISSION_DEBOUNCED, admit(COMMAND_CLASS_VALVE, "on"));
+    host::advanceTime(1);
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_VALVE, "on"));
+
+    // A different state, or a relay that is not where the command left it, gets through
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_VALVE, "off"));
+    TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_VALVE, "off")); // relay still high
+    digitalWrite(pinRelay, LOW);
+    TEST_ASSERT_EQUAL(ADMISSION_DEBOUNCED, admit(COMMAND_CLASS_VALVE, "off"));
+}
+
+void test_data_requests_coalesce(void)
+{
+    bool force = false;
+
+    TEST_ASSERT_TRUE(commandAdmissionQueueDataRequest(false));
+    TEST_ASSERT_FALSE(commandAdmissionQueueDataRequest(true));
+    TEST_ASSERT_TRUE(commandAdmissionTakeDataRequest(force));
+    TEST_ASSERT_TRUE(force); // a forced read in the burst wins
+    TEST_ASSERT_FALSE(commandAdmissionTakeDataRequest(force));
+
+    TEST_ASSERT_TRUE(commandAdmissionQueueDataRequest(false));
+    host::advanceTime(999);
+    TEST_ASSERT_FALSE(commandAdmissionTakeDataRequest(force));
+    host::advanceTime(1);
+    TEST_ASSERT_TRUE(commandAdmissionTakeDataRequest(force));
+    TEST_ASSERT_FALSE(force);
+}
+
+void test_rejection_reports_are_rate_limited(void)
+{
+    unsigned long suppressed = 99;
+
+    TEST_ASSERT_TRUE(commandAdmissionReportRejection(suppressed));
+    TEST_ASSERT_EQUAL(0, suppressed);
+    for (int i = 0; i < 3; i++)
+        TEST_ASSERT_FALSE(commandAdmissionReportRejection(suppressed));
+
+    host::advanceTime(9999);
+    TEST_ASSERT_FALSE(commandAdmissionReportRejection(suppressed));
+    host::advanceTime(1);
+    TEST_ASSERT_TRUE(commandAdmissionReportRejection(suppressed));
+    TEST_ASSERT_EQUAL(4, suppressed);
+}
+
+void test_ping_flood_publishes_one_rejection_event(void)
+{
+    initMQTThandlers();
+
+    for (int i = 0; i < 15; i++)
+        deliver("{\"command\":\"ping\"}");
+    mqttQueueProcess(recordingSender, 1000);
+
+    TEST_ASSERT_EQUAL(10, commandStats.accepted);
+    TEST_ASSERT_EQUAL(5, commandStats.rateLimited);
+    TEST_ASSERT_EQUAL(10, countEvents("ping_response"));
+    TEST_ASSERT_EQUAL(1, countEvents("command_rejected"));
+
+    DynamicJsonDocument rejected(1024);
+    for (const std::string &event : events)
+        if (event.find("command_rejected") != std::string::npos)
+            deserializeJson(rejected, event);
+    TEST_ASSERT_EQUAL_STRING("ping", rejected["command"]);
+    TEST_ASSERT_EQUAL_STRING("rate limited", rejected["reason"]);
+
+    host::advanceTime(10000);
+    events.clear();
+    for (int i = 0; i < 12; i++)
+        deliver("{\"command\":\"ping\"}");
+    mqttQueueProcess(recordingSender, 1000);
+    TEST_ASSERT_EQUAL(1, countEvents("command_rejected"));
+    for (const std::string &event : events)
+        if (event.find("command_rejected") != std::string::npos)
+            deserializeJson(rejected, event);
+    TEST_ASSERT_EQUAL(4, rejected["suppressed"].as<int>()); // from the first flood
+}
+
+void test_admission_reads_valve_state_before_full_parse(void)
+{
+    initMQTThandlers();
+
+    // Exhaust the valve bucket: "on" needs the state from the first pass
+    for (int i = 0; i < 5; i++)
+        TEST_ASSERT_EQUAL(ADMISSION_ACCEPTED, admit(COMMAND_CLASS_VALVE, "on"));
+
+    deliver("{\"command\":\"setValve\",\"state\":\"on\",\"minutes\":1}");
+    TEST_ASSERT_EQUAL(1, commandStats.rateLimited);
+    TEST_ASSERT_EQUAL(LOW, digitalRead(pinRelay));
+
+    deliver("{\"command\":\"setValve\",\"state\":\"off\"}");
+    TEST_ASSERT_EQUAL(1, commandStats.accepted);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_query_bucket_bursts_then_refills);
+    RUN_TEST(test_buckets_are_per_class);
+    RUN_TEST(test_valve_off_is_never_rate_limited);
+    RUN_TEST(test_repeated_valve_state_is_debounced);
+    RUN_TEST(test_data_requests_coalesce);
+    RUN_TEST(test_rejection_reports_are_rate_limited);
+    RUN_TEST(test_ping_flood_publishes_one_rejection_event);
+    RUN_TEST(test_admission_reads_valve_state_before_full_parse);
+    return UNITY_END();
+}
@@ -0,0 +1,304 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "host_hal.h"
+#include "globals.h"
+#include "mqtt.h"
+#include "gateway.h"
+#include "sim_link.h"
+
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+
+struct Published
+{
+    std::string topic;
+    std::string payload;
+};
+
+static SimulatedLink *link = nullptr;
+static std::vector<Published> published;
+static std::vector<NodeCommandFrame> commandsToNodes;
+
+static MqttSendResult recordingSender(const char *topic, const char *payload, size_t length, unsigned long ageMs)
+{
+    published.push_back({topic, std::string(payload, length)});
+    return MQTT_SEND_OK;
+}
+
+static NodeAddress nodeAddress(uint8_t n)
+{
+    return {{0x5C, 0xCF, 0x7F, 0x00, 0x00, n}};
+}
+
+static void sendReading(uint8_t n, uint16_t seq, uint16_t raw, uint8_t commandSeq = 0, uint8_t valveOpen = 0,
+                        int8_t rssi = -60)
+{
+    NodeReadingFrame frame = {NODE_FRAME_READING, nodeProtocolVersion, seq, raw, 3900, valveOpen, commandSeq};
+    link->transmit(nodeAddress(n), (const uint8_t *)&frame, sizeof(frame), rssi);
+}
+
+// Runs the gateway and hands everything it published to the recorder
+static void step()
+{
+    gatewayLoop();
+    mqttQueueProcess(recordingSender, 1000);
+}
+
+// Entries of every batch published so far, in order
+static std::vector<std::string> batchEntries(const char *field)
+{
+    std::vector<std::string> values;
+    for (const Published &msg : published)
+    {
+        if (msg.topic != topics.data.c_str())
+            continue;
+        DynamicJsonDocument doc(4096);
+        TEST_ASSERT_FALSE(deserializeJson(doc, msg.payload));
+        for (JsonVariantConst entry : doc.as<JsonVariantConst>()["nodes"].as<JsonArrayConst>())
+        {
+            JsonVariantConst value = entry[field];
+            std::string text = "-";
+            if (value.is<const char *>())
+                text = value.as<const char *>();
+            else if (!value.isNull())
+                serializeJson(value, text);
+            values.push_back(text);
+        }
+    }
+    return values;
+}
+
+static std::vector<std::string> valveResults()
+{
+    std::vector<std::string> results;
+    for (const Published &msg : published)
+    {
+        if (msg.topic != topics.valve.c_str())
+            continue;
+        DynamicJsonDocument doc(1024);
+        TEST_ASSERT_FALSE(deserializeJson(doc, msg.payload));
+        results.push_back(doc["command_result"].as<std::string>());
+    }
+    return results;
+}
+
+void setUp(void)
+{
+    host::setTimeMs(1000);
+    host::resetPins();
+    topics.systemEvents = "t/events";
+    topics.data = "t/data";
+    topics.valve = "t/valve";
+    mqttQueueClear();
+    published.clear();
+    commandsToNodes.clear();
+
+    link = new SimulatedLink();
+    link->deliverToNode = [](const NodeAddress &to, const uint8_t *data, size_t length) {
+        NodeCommandFrame frame;
+        TEST_ASSERT_EQUAL(sizeof(frame), length);
+        memcpy(&frame, data, sizeof(frame));
+        commandsToNodes.push_back(frame);
+    };
+    gatewaySetup(*link);
+}
+
+void tearDown(void)
+{
+    delete link;
+    link = nullptr;
+}
+
+void test_reading_waits_for_the_batch_window(void)
+{
+    sendReading(1, 1, 512);
+    step();
+    TEST_ASSERT_EQUAL(0, batchEntries("node").size());
+
+    host::advanceTime(10000);
+    step();
+    std::vector<std::string> ids = batchEntries("node");
+    TEST_ASSERT_EQUAL(1, ids.size());
+    TEST_ASSERT_EQUAL_STRING("5CCF7F000001", ids[0].c_str());
+    std::vector<std::string> raw = batchEntries("raw");
+    std::vector<std::string> rssi = batchEntries("rssi");
+    std::vector<std::string> age = batchEntries("age_s");
+    TEST_ASSERT_EQUAL_STRING("512", raw[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("-60", rssi[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("10", age[0].c_str());
+}
+
+void test_full_batch_keeps_every_node_id(void)
+{
+    // Five nodes fill the document exactly; copying the ids used to overflow it
+    for (uint8_t n = 1; n <= 5; n++)
+        sendReading(n, 1, 400 + n, 0, 0, n == 3 ? 0 : -70);
+    step();
+
+    std::vector<std::string> ids = batchEntries("node");
+    TEST_ASSERT_EQUAL(5, ids.size());
+    TEST_ASSERT_EQUAL_STRING("5CCF7F000005", ids[4].c_str());
+    std::vector<std::string> rssi = batchEntries("rssi");
+    TEST_ASSERT_EQUAL_STRING("-", rssi[2].c_str()); // radio gave no RSSI
+    TEST_ASSERT_EQUAL(1, gatewayStats().batches);
+    for (const Published &msg : published)
+        TEST_ASSERT_TRUE(msg.payload.find("mqtt_payload_overflow") == std::string::npos);
+}
+
+void test_link_retry_is_a_duplicate(void)
+{
+    sendReading(1, 7, 500);
+    sendReading(1, 7, 500);
+    step();
+
+    TEST_ASSERT_EQUAL(1, gatewayStats().readings);
+    TEST_ASSERT_EQUAL(1, gatewayStats().duplicates);
+}
+
+void test_same_seq_after_a_while_is_a_new_reading(void)
+{
+    // A node that rebooted starts counting again and can repeat its last seq
+    sendReading(1, 1, 500);
+    step();
+    host::advanceTime(10000);
+    step();
+
+    sendReading(1, 1, 620);
+    step();
+    host::advanceTime(10000);
+    step();
+
+    TEST_ASSERT_EQUAL(2, gatewayStats().readings);
+    TEST_ASSERT_EQUAL(0, gatewayStats().duplicates);
+    std::vector<std::string> raw = batchEntries("raw");
+    TEST_ASSERT_EQUAL(2, raw.size());
+    TEST_ASSERT_EQUAL_STRING("620", raw[1].c_str());
+}
+
+void test_command_is_resent_until_acknowledged(void)
+{
+    TEST_ASSERT_FALSE(gatewayQueueValveCommand("5CCF7F000001", true, 10)); // not seen yet
+
+    sendReading(1, 1, 500);
+    step();
+    TEST_ASSERT_TRUE(gatewayQueueValveCommand("5ccf7f000001", true, 10));
+    TEST_ASSERT_EQUAL(1, commandsToNodes.size());
+    TEST_ASSERT_EQUAL(1, commandsToNodes[0].commandSeq);
+    TEST_ASSERT_EQUAL(1, commandsToNodes[0].valveOpen);
+    TEST_ASSERT_EQUAL(10, commandsToNodes[0].minutes);
+
+    // Node was asleep: its next reading still reports no command applied
+    host::advanceTime(300000);
+    sendReading(1, 2, 500, 0);
+    step();
+    TEST_ASSERT_EQUAL(2, commandsToNodes.size());
+    TEST_ASSERT_EQUAL(0, valveResults().size());
+
+    host::advanceTime(300000);
+    sendReading(1, 3, 500, 1, 1);
+    step();
+    TEST_ASSERT_EQUAL(2, commandsToNodes.size());
+    std::vector<std::string> results = valveResults();
+    TEST_ASSERT_EQUAL(1, results.size());
+    TEST_ASSERT_EQUAL_STRING("node_valve_on", results[0].c_str());
+    TEST_ASSERT_EQUAL(1, gatewayStats().commandsAcked);
+}
+
+void test_unacknowledged_command_expires(void)
+{
+    sendReading(1, 1, 500);
+    step();
+    TEST_ASSERT_TRUE(gatewayQueueValveCommand("5CCF7F000001", false, 0));
+
+    host::advanceTime(60UL * 60UL * 1000UL - 1);
+    step();
+    TEST_ASSERT_EQUAL(0, valveResults().size());
+    host::advanceTime(1);
+    step();
+    std::vector<std::string> results = valveResults();
+    TEST_ASSERT_EQUAL(1, results.size());
+    TEST_ASSERT_EQUAL_STRING("node_command_expired", results[0].c_str());
+
+    // Nothing is pending any more, so the node's next wake gets no reply
+    sendReading(1, 2, 500);
+    step();
+    TEST_ASSERT_EQUAL(1, commandsToNodes.size());
+}
+
+void test_newer_command_supersedes(void)
+{
+    sendReading(1, 1, 500);
+    step();
+    TEST_ASSERT_TRUE(gatewayQueueValveCommand("5CCF7F000001", true, 5));
+    TEST_ASSERT_TRUE(gatewayQueueValveCommand("5CCF7F000001", false, 0));
+    step();
+
+    std::vector<std::string> results = valveResults();
+    TEST_ASSERT_EQUAL(1, results.size());
+    TEST_ASSERT_EQUAL_STRING("node_command_superseded", results[0].c_str());
+    TEST_ASSERT_EQUAL(2, commandsToNodes.back().commandSeq);
+
+    // The ack of the old command does not resolve the new one
+    sendReading(1, 2, 500, 1, 1);
+    step();
+    TEST_ASSERT_EQUAL(1, valveResults().size());
+    sendReading(1, 3, 500, 2, 0);
+    step();
+    results = valveResults();
+    TEST_ASSERT_EQUAL(2, results.size());
+    TEST_ASSERT_EQUAL_STRING("node_valve_off", results[1].c_str());
+}
+
+void test_full_table_reuses_the_stalest_slot(void)
+{
+    for (uint8_t n = 1; n <= 16; n++)
+        sendReading(n, 1, 500);
+    for (int i = 0; i < 2; i++)
+        step();
+    host::advanceTime(10000);
+    step();
+    TEST_ASSERT_EQUAL(16, gatewayNodeCount());
+
+    // Everyone is recent: the newcomer is refused
+    sendReading(17, 1, 500);
+    step();
+    TEST_ASSERT_EQUAL(1, gatewayStats().tableFull);
+
+    // Nodes 2..16 keep reporting, node 1 goes silent for 6 hours
+    for (int hour = 0; hour < 6; hour++)
+    {
+        host::advanceTime(60UL * 60UL * 1000UL);
+        for (uint8_t n = 2; n <= 16; n++)
+            sendReading(n, hour + 2, 500);
+        for (int i = 0; i < 2; i++)
+            step();
+    }
+
+    sendReading(17, 2, 500);
+    step();
+    TEST_ASSERT_EQUAL(16, gatewayNodeCount());
+    TEST_ASSERT_EQUAL(1, gatewayStats().nodesEvicted);
+    NodeAddress silent = nodeAddress(1);
+    TEST_ASSERT_EQUAL(1, link->forgotten.size()); // its ESP-NOW peer entry goes too
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(silent.mac, link->forgotten[0].mac, 6);
+    TEST_ASSERT_FALSE(gatewayQueueValveCommand("5CCF7F000001", true, 1));
+    TEST_ASSERT_TRUE(gatewayQueueValveCommand("5CCF7F000011", true, 1));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_reading_waits_for_the_batch_window);
+    RUN_TEST(test_full_batch_keeps_every_node_id);
+    RUN_TEST(test_link_retry_is_a_duplicate);
+    RUN_TEST(test_same_seq_after_a_while_is_a_new_reading);
+    RUN_TEST(test_command_is_resent_until_acknowledged);
+    RUN_TEST(test_unacknowledged_command_expires);
+    RUN_TEST(test_newer_command_supersedes);
+    RUN_TEST(test_full_table_reuses_the_stalest_slot);
+    return UNITY_END();
+}
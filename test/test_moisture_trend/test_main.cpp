@@ -0,0 +1,203 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <unity.h>
+#include "globals.h"
+#include "moisture_trend.h"
+
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+
+// The trend module keeps its history in statics, so the clock only moves
+// forward across tests and every test refills the whole ring first. The
+// module sees the low 32 bits, like millis() on the device.
+static uint64_t nowMs = 0;
+
+static void addSample(long centiPercent, unsigned long stepS)
+{
+    nowMs += stepS * 1000ULL;
+    moistureTrendAddSample((int)centiPercent, (uint32_t)nowMs);
+}
+
+// 127 samples 5 minutes apart, dropping 3 %/h: 90 % down to 58.5 %
+static void feedDrying()
+{
+    for (long i = 0; i < trendHistoryCapacity - 1; i++)
+        addSample(9000 - 25 * i, 300);
+}
+
+void setUp(void)
+{
+    // Identity mapping: a raw reading is moisture in centi-percent
+    soilMoistureCalibrationMax = 0;
+    soilMoistureCalibrationMin = 10000;
+    moistureTrendSetWindowSize(0, 12);
+    moistureTrendSetWindowSize(1, 96);
+}
+
+void tearDown(void)
+{
+}
+
+void test_linear_drying_fit(void)
+{
+    feedDrying();
+
+    TrendStats stats;
+    TEST_ASSERT_TRUE(moistureTrendGetStats(1, stats));
+    TEST_ASSERT_EQUAL_UINT16(96, stats.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -3.0f, stats.slopePerHour);
+    TEST_ASSERT_EQUAL_INT16(5850, stats.min);
+    TEST_ASSERT_EQUAL_INT16(8225, stats.max);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 70.375f, stats.mean);
+
+    TEST_ASSERT_TRUE(moistureTrendGetStats(0, stats));
+    TEST_ASSERT_EQUAL_UINT16(12, stats.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -3.0f, stats.slopePerHour);
+
+    // (58.5 - 30) % at 3 %/h
+    TEST_ASSERT_INT_WITHIN(1, 570, moistureTrendMinutesToLimit(30));
+}
+
+void test_limit_outside_percent_range_gives_no_forecast(void)
+{
+    feedDrying();
+
+    TEST_ASSERT_EQUAL_INT(-1, moistureTrendMinutesToLimit(150));
+    TEST_ASSERT_EQUAL_INT(-1, moistureTrendMinutesToLimit(101));
+    TEST_ASSERT_EQUAL_INT(0, moistureTrendMinutesToLimit(100)); // already below
+    TEST_ASSERT_INT_WITHIN(1, 1170, moistureTrendMinutesToLimit(0));
+}
+
+void test_json_uses_default_limit(void)
+{
+    feedDrying();
+    unsigned int savedLimit = defaultMoistureLimit;
+    DynamicJsonDocument doc(1024);
+
+    defaultMoistureLimit = 150;
+    moistureTrendToJson(doc.createNestedObject("trend"));
+    TEST_ASSERT_TRUE(doc["trend"]["minutes_to_limit"].isNull());
+    TEST_ASSERT_EQUAL_INT(150, doc["trend"]["limit"].as<int>());
+
+    doc.clear();
+    defaultMoistureLimit = 30;
+    moistureTrendToJson(doc.createNestedObject("trend"));
+    TEST_ASSERT_INT_WITHIN(1, 570, doc["trend"]["minutes_to_limit"].as<long>());
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -3.0f, doc["trend"]["long"]["slope_h"].as<float>());
+
+    defaultMoistureLimit = savedLimit;
+}
+
+void test_not_drying_gives_no_forecast(void)
+{
+    for (long i = 0; i < trendHistoryCapacity - 1; i++)
+        addSample(4000 + 10 * i, 300);
+
+    TEST_ASSERT_EQUAL_INT(-1, moistureTrendMinutesToLimit(30));
+}
+
+void test_fit_exact_after_long_uptime(void)
+{
+    // About 3 years of 40-day gaps, crossing the millis() wrap every time:
+    // absolute times would overflow count * sumTT
+    for (int i = 0; i < 30; i++)
+        addSample(5000, 40UL * 86400UL);
+    feedDrying();
+
+    TrendStats stats;
+    TEST_ASSERT_TRUE(moistureTrendGetStats(1, stats));
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -3.0f, stats.slopePerHour);
+    TEST_ASSERT_INT_WITHIN(1, 570, moistureTrendMinutesToLimit(30));
+}
+
+void test_window_spanning_a_gap(void)
+{
+    // The gap sample stays inside the long window until it is evicted
+    feedDrying();
+    addSample(5000, 86400);
+    for (int i = 0; i < 95; i++)
+        addSample(5000, 300);
+
+    TrendStats stats;
+    TEST_ASSERT_TRUE(moistureTrendGetStats(1, stats));
+    TEST_ASSERT_EQUAL_UINT16(96, stats.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, stats.slopePerHour);
+    TEST_ASSERT_EQUAL_INT16(5000, stats.min);
+    TEST_ASSERT_EQUAL_INT16(5000, stats.max);
+}
+
+void test_min_max_follow_eviction(void)
+{
+    for (long i = 0; i < trendHistoryCapacity - 1; i++)
+    {
+        long value = 5000;
+        if (i == 100)
+            value = 9500;
+        if (i == 120)
+            value = 1000;
+        addSample(value, 300);
+    }
+
+    TrendStats stats;
+    TEST_ASSERT_TRUE(moistureTrendGetStats(0, stats)); // last 12: 114..125
+    TEST_ASSERT_EQUAL_INT16(1000, stats.min);
+    TEST_ASSERT_EQUAL_INT16(5000, stats.max);
+
+    TEST_ASSERT_TRUE(moistureTrendGetStats(1, stats)); // last 96: 30..125
+    TEST_ASSERT_EQUAL_INT16(1000, stats.min);
+    TEST_ASSERT_EQUAL_INT16(9500, stats.max);
+
+    for (int i = 0; i < 6; i++)
+        addSample(5000, 300);
+    TEST_ASSERT_TRUE(moistureTrendGetStats(0, stats)); // 120 is out
+    TEST_ASSERT_EQUAL_INT16(5000, stats.min);
+}
+
+void test_burst_of_forced_reads_is_not_sampled(void)
+{
+    feedDrying();
+
+    // getData with force, once a second: only the periodic read lands
+    for (int i = 0; i < 30; i++)
+        addSample(i % 2 ? 9000 : 1000, 1);
+    addSample(5850 - 25, 270);
+
+    TrendStats stats;
+    TEST_ASSERT_TRUE(moistureTrendGetStats(0, stats));
+    TEST_ASSERT_EQUAL_UINT16(12, stats.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -3.0f, stats.slopePerHour);
+    TEST_ASSERT_EQUAL_INT16(5825, stats.min);
+    TEST_ASSERT_EQUAL_INT16(6100, stats.max);
+}
+
+void test_window_resize_rebuilds_from_history(void)
+{
+    feedDrying();
+
+    TEST_ASSERT_TRUE(moistureTrendSetWindowSize(1, 24));
+    TEST_ASSERT_FALSE(moistureTrendSetWindowSize(1, trendHistoryCapacity));
+    TEST_ASSERT_FALSE(moistureTrendSetWindowSize(1, 1));
+
+    TrendStats stats;
+    TEST_ASSERT_TRUE(moistureTrendGetStats(1, stats));
+    TEST_ASSERT_EQUAL_UINT16(24, stats.count);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -3.0f, stats.slopePerHour);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 61.375f, stats.mean);
+    TEST_ASSERT_INT_WITHIN(1, 570, moistureTrendMinutesToLimit(30));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_linear_drying_fit);
+    RUN_TEST(test_limit_outside_percent_range_gives_no_forecast);
+    RUN_TEST(test_json_uses_default_limit);
+    RUN_TEST(test_not_drying_gives_no_forecast);
+    RUN_TEST(test_fit_exact_after_long_uptime);
+    RUN_TEST(test_window_spanning_a_gap);
+    RUN_TEST(test_min_max_follow_eviction);
+    RUN_TEST(test_burst_of_forced_reads_is_not_sampled);
+    RUN_TEST(test_window_resize_rebuilds_from_history);
+    return UNITY_END();
+}
@@ -0,0 +1,267 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "host_hal.h"
+#include "mqtt_queue.h"
+
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+
+struct SentMessage
+{
+    std::string topic;
+    std::string payload;
+    unsigned long ageMs;
+};
+
+static std::vector<SentMessage> sent;
+static MqttSendResult nextResult = MQTT_SEND_OK;
+static unsigned long sendCostMs = 0;
+static void (*duringSend)() = nullptr;
+
+static MqttSendResult recordingSender(const char *topic, const char *payload, size_t length, unsigned long ageMs)
+{
+    sent.push_back({topic, std::string(payload, length), ageMs});
+    host::advanceTime(sendCostMs);
+    if (duringSend)
+        duringSend();
+    return nextResult;
+}
+
+static bool push(const char *topic, int value, MqttPriority priority)
+{
+    StaticJsonDocument<JSON_OBJECT_SIZE(1)> doc;
+    doc["v"] = value;
+    return mqttQueuePush(topic, doc, priority);
+}
+
+static bool pushBytes(const char *topic, size_t length, MqttPriority priority)
+{
+    std::string filler(length, 'x');
+    DynamicJsonDocument doc(JSON_OBJECT_SIZE(1) + length + 1);
+    doc["s"] = filler.c_str();
+    return mqttQueuePush(topic, doc, priority);
+}
+
+static size_t drain()
+{
+    return mqttQueueProcess(recordingSender, 1000);
+}
+
+void setUp(void)
+{
+    nextResult = MQTT_SEND_OK;
+    sendCostMs = 0;
+    duringSend = nullptr;
+    mqttQueueClear();
+    sent.clear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_sends_by_priority_then_age(void)
+{
+    push("t/data", 1, MQTT_PRIORITY_TELEMETRY);
+    push("t/events", 2, MQTT_PRIORITY_SYSTEM);
+    push("t/valve", 3, MQTT_PRIORITY_SAFETY);
+    push("t/events", 4, MQTT_PRIORITY_SYSTEM);
+
+    TEST_ASSERT_EQUAL(4, drain());
+    TEST_ASSERT_EQUAL(4, sent.size());
+    TEST_ASSERT_EQUAL_STRING("{\"v\":3}", sent[0].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"v\":2}", sent[1].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"v\":4}", sent[2].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("t/data", sent[3].topic.c_str());
+    TEST_ASSERT_EQUAL(0, mqttQueueDepth());
+    TEST_ASSERT_EQUAL(0, mqttQueueBytes());
+}
+
+void test_reports_time_spent_queued(void)
+{
+    push("t/events", 1, MQTT_PRIORITY_SYSTEM);
+    host::advanceTime(1500);
+
+    drain();
+    TEST_ASSERT_EQUAL(1, sent.size());
+    TEST_ASSERT_EQUAL(1500, sent[0].ageMs);
+}
+
+void test_telemetry_coalesces_per_topic(void)
+{
+    unsigned long coalesced = mqttQueueStats().coalesced;
+
+    push("t/data", 1, MQTT_PRIORITY_TELEMETRY);
+    push("t/data", 2, MQTT_PRIORITY_TELEMETRY);
+    push("t/other", 3, MQTT_PRIORITY_TELEMETRY);
+    push("t/events", 4, MQTT_PRIORITY_SYSTEM);
+    push("t/events", 5, MQTT_PRIORITY_SYSTEM);
+
+    TEST_ASSERT_EQUAL(4, mqttQueueDepth());
+    TEST_ASSERT_EQUAL(coalesced + 1, mqttQueueStats().coalesced);
+
+    drain();
+    TEST_ASSERT_EQUAL(4, sent.size());
+    TEST_ASSERT_EQUAL_STRING("{\"v\":2}", sent[2].payload.c_str()); // newest snapshot, original place in line
+    TEST_ASSERT_EQUAL_STRING("{\"v\":3}", sent[3].payload.c_str());
+}
+
+void test_full_queue_evicts_oldest_lowest_priority(void)
+{
+    char topic[16];
+    for (int i = 0; i < 16; i++)
+    {
+        snprintf(topic, sizeof(topic), "t/data/%d", i);
+        TEST_ASSERT_TRUE(push(topic, i, MQTT_PRIORITY_TELEMETRY));
+    }
+    TEST_ASSERT_EQUAL(16, mqttQueueDepth());
+
+    unsigned long dropped = mqttQueueStats().dropped;
+    TEST_ASSERT_TRUE(push("t/valve", 100, MQTT_PRIORITY_SAFETY));
+    TEST_ASSERT_EQUAL(16, mqttQueueDepth());
+    TEST_ASSERT_EQUAL(dropped + 1, mqttQueueStats().dropped);
+
+    drain();
+    TEST_ASSERT_EQUAL_STRING("t/valve", sent[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("t/data/1", sent[1].topic.c_str()); // t/data/0 was the victim
+}
+
+void test_full_queue_rejects_lower_priority(void)
+{
+    for (int i = 0; i < 16; i++)
+        TEST_ASSERT_TRUE(push("t/valve", i, MQTT_PRIORITY_SAFETY));
+
+    TEST_ASSERT_FALSE(push("t/events", 99, MQTT_PRIORITY_SYSTEM));
+    TEST_ASSERT_FALSE(push("t/data", 99, MQTT_PRIORITY_TELEMETRY));
+    TEST_ASSERT_EQUAL(16, mqttQueueDepth());
+
+    // Equal priority replaces the oldest
+    TEST_ASSERT_TRUE(push("t/valve", 16, MQTT_PRIORITY_SAFETY));
+    drain();
+    TEST_ASSERT_EQUAL(16, sent.size());
+    TEST_ASSERT_EQUAL_STRING("{\"v\":1}", sent[0].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("{\"v\":16}", sent[15].payload.c_str());
+}
+
+void test_byte_cap_evicts_and_rejects_oversized(void)
+{
+    TEST_ASSERT_TRUE(pushBytes("t/events", 1500, MQTT_PRIORITY_SYSTEM));
+    TEST_ASSERT_TRUE(pushBytes("t/events", 1500, MQTT_PRIORITY_SYSTEM));
+    TEST_ASSERT_EQUAL(2, mqttQueueDepth());
+
+    TEST_ASSERT_TRUE(pushBytes("t/valve", 1500, MQTT_PRIORITY_SAFETY));
+    TEST_ASSERT_EQUAL(2, mqttQueueDepth());
+    TEST_ASSERT_LESS_OR_EQUAL(4096, mqttQueueBytes());
+
+    TEST_ASSERT_FALSE(pushBytes("t/events", 5000, MQTT_PRIORITY_SAFETY));
+    TEST_ASSERT_EQUAL(2, mqttQueueDepth());
+
+    drain();
+    TEST_ASSERT_EQUAL_STRING("t/valve", sent[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("t/events", sent[1].topic.c_str());
+
+    // A coalesced snapshot that grows is held to the cap too: older
+    // telemetry makes room, the replaced slot itself does not
+    TEST_ASSERT_TRUE(pushBytes("t/other", 1500, MQTT_PRIORITY_TELEMETRY));
+    TEST_ASSERT_TRUE(pushBytes("t/data", 100, MQTT_PRIORITY_TELEMETRY));
+    TEST_ASSERT_TRUE(pushBytes("t/events", 1500, MQTT_PRIORITY_SYSTEM));
+    TEST_ASSERT_TRUE(pushBytes("t/data", 1500, MQTT_PRIORITY_TELEMETRY));
+    TEST_ASSERT_EQUAL(2, mqttQueueDepth());
+    TEST_ASSERT_LESS_OR_EQUAL(4096, mqttQueueBytes());
+
+    // Nothing left to evict below it: the push is refused, the older snapshot stays
+    TEST_ASSERT_FALSE(pushBytes("t/data", 3000, MQTT_PRIORITY_TELEMETRY));
+    TEST_ASSERT_EQUAL(2, mqttQueueDepth());
+    TEST_ASSERT_LESS_OR_EQUAL(4096, mqttQueueBytes());
+
+    sent.clear();
+    drain();
+    TEST_ASSERT_EQUAL(2, sent.size());
+    TEST_ASSERT_EQUAL_STRING("t/events", sent[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("t/data", sent[1].topic.c_str());
+    TEST_ASSERT_EQUAL(1500 + 8, sent[1].payload.size());
+}
+
+void test_retry_keeps_message_and_stops(void)
+{
+    push("t/events", 1, MQTT_PRIORITY_SYSTEM);
+    push("t/events", 2, MQTT_PRIORITY_SYSTEM);
+    unsigned long retries = mqttQueueStats().retries;
+
+    nextResult = MQTT_SEND_RETRY;
+    TEST_ASSERT_EQUAL(0, drain());
+    TEST_ASSERT_EQUAL(1, sent.size());
+    TEST_ASSERT_EQUAL(2, mqttQueueDepth());
+    TEST_ASSERT_EQUAL(retries + 1, mqttQueueStats().retries);
+
+    nextResult = MQTT_SEND_OK;
+    sent.clear();
+    TEST_ASSERT_EQUAL(2, drain());
+    TEST_ASSERT_EQUAL_STRING("{\"v\":1}", sent[0].payload.c_str());
+}
+
+void test_drop_result_discards_message(void)
+{
+    push("t/events", 1, MQTT_PRIORITY_SYSTEM);
+    unsigned long dropped = mqttQueueStats().dropped;
+
+    nextResult = MQTT_SEND_DROP;
+    TEST_ASSERT_EQUAL(1, drain());
+    TEST_ASSERT_EQUAL(0, mqttQueueDepth());
+    TEST_ASSERT_EQUAL(dropped + 1, mqttQueueStats().dropped);
+}
+
+void test_budget_limits_messages_per_call(void)
+{
+    for (int i = 0; i < 5; i++)
+        push("t/events", i, MQTT_PRIORITY_SYSTEM);
+
+    sendCostMs = 10;
+    TEST_ASSERT_EQUAL(1, mqttQueueProcess(recordingSender, 0)); // always at least one
+    TEST_ASSERT_EQUAL(2, mqttQueueProcess(recordingSender, 20));
+    TEST_ASSERT_EQUAL(2, mqttQueueDepth());
+}
+
+static void fillWithSafety()
+{
+    duringSend = nullptr;
+    for (int i = 0; i < 20; i++)
+        push("t/valve", i, MQTT_PRIORITY_SAFETY);
+}
+
+void test_message_being_sent_is_never_evicted(void)
+{
+    push("t/data", 1, MQTT_PRIORITY_TELEMETRY);
+
+    // A callback on another task fills the queue while the telemetry is on the wire
+    duringSend = fillWithSafety;
+    TEST_ASSERT_EQUAL(1, mqttQueueProcess(recordingSender, 0));
+    TEST_ASSERT_EQUAL_STRING("t/data", sent[0].topic.c_str());
+
+    // The in-flight slot held its place, so only 15 of the safety messages fit
+    TEST_ASSERT_EQUAL(15, mqttQueueDepth());
+    sent.clear();
+    drain();
+    TEST_ASSERT_EQUAL(15, sent.size());
+    TEST_ASSERT_EQUAL_STRING("{\"v\":5}", sent[0].payload.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_sends_by_priority_then_age);
+    RUN_TEST(test_reports_time_spent_queued);
+    RUN_TEST(test_telemetry_coalesces_per_topic);
+    RUN_TEST(test_full_queue_evicts_oldest_lowest_priority);
+    RUN_TEST(test_full_queue_rejects_lower_priority);
+    RUN_TEST(test_byte_cap_evicts_and_rejects_oversized);
+    RUN_TEST(test_retry_keeps_message_and_stops);
+    RUN_TEST(test_drop_result_discards_message);
+    RUN_TEST(test_budget_limits_messages_per_call);
+    RUN_TEST(test_message_being_sent_is_never_evicted);
+    return UNITY_END();
+}